@@ -0,0 +1,637 @@
+#include <algorithm>
+#include <any>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "bplustree.hpp"
+#include "database.hpp"
+
+using std::string;
+using std::vector;
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+// Heap allocations of the whole process, counted by replacing the global operator new
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+/*
+    YCSB style workloads over BPlusTree and DB on a temporary file
+
+    ./database_bench [--target tree,db] [--workload insert_seq,insert_rand,get,update,delete,mixed]
+                     [--keys N] [--ops N] [--value-size 100,1000] [--threads 1,4] [--dist uniform|zipfian]
+                     [--read-ratio 0.95] [--batch N] [--io mmap|pread|direct] [--page-size 4096] [--dir PATH] [--json PATH]
+
+    Lists run every combination. get, update, delete and mixed run on keys loaded up front.
+    Writes of a batch are committed together, the commit shows up in the latency of the op completing the batch.
+    Heap allocations per op count those of the whole process, tree reads reuse their key and value buffers.
+*/
+
+struct Config {
+    vector<string> targets = {"tree", "db"};
+    vector<string> workloads = {"insert_seq", "insert_rand", "get", "update", "delete", "mixed"};
+    uint64_t keys = 100000;
+    uint64_t ops = 20000;
+    vector<uint64_t> value_sizes = {100};
+    vector<uint64_t> threads = {1};
+    string dist = "zipfian";
+    double read_ratio = 0.95;
+    uint64_t batch = 1;
+    string io = "mmap";
+    uint64_t page_size = DEFAULT_PAGE_SIZE;
+    string dir = std::filesystem::temp_directory_path();
+    string json;
+};
+
+struct Run {
+    string target;
+    string workload;
+    uint64_t value_size;
+    uint64_t threads;
+};
+
+// Log-linear latency buckets in nanoseconds, 16 per power of two, about 6% resolution
+class Histogram {
+    public:
+        Histogram() : counts(64 * SUB_BUCKETS, 0) {}
+
+        void Record(uint64_t nanos) {
+            counts[Bucket(nanos)]++;
+            total++;
+            sum += nanos;
+            max = std::max(max, nanos);
+        }
+
+        void Merge(const Histogram& other) {
+            for(size_t i = 0; i < counts.size(); i++) {
+                counts[i] += other.counts[i];
+            }
+            total += other.total;
+            sum += other.sum;
+            max = std::max(max, other.max);
+        }
+
+        // Upper bound of the bucket holding the quantile
+        uint64_t Percentile(double quantile) const {
+            uint64_t rank = std::ceil(quantile * total);
+            uint64_t seen = 0;
+            for(size_t i = 0; i < counts.size(); i++) {
+                seen += counts[i];
+                if(seen >= rank && seen > 0) {
+                    return std::min(BucketUpper(i), max);
+                }
+            }
+            return max;
+        }
+
+        double Mean() const {
+            return total == 0 ? 0 : double(sum) / total;
+        }
+
+        uint64_t total = 0;
+        uint64_t max = 0;
+
+    private:
+        static constexpr uint64_t SUB_BUCKETS = 16;
+
+        static size_t Bucket(uint64_t nanos) {
+            if(nanos < SUB_BUCKETS) {
+                return nanos;
+            }
+            uint64_t power = 63 - __builtin_clzll(nanos);
+            uint64_t sub = (nanos >> (power - 4)) & (SUB_BUCKETS - 1);
+            return (power - 3) * SUB_BUCKETS + sub;
+        }
+
+        static uint64_t BucketUpper(size_t bucket) {
+            if(bucket < SUB_BUCKETS) {
+                return bucket;
+            }
+            uint64_t power = bucket / SUB_BUCKETS + 3;
+            uint64_t sub = bucket % SUB_BUCKETS;
+            return ((SUB_BUCKETS + sub + 1) << (power - 4)) - 1;
+        }
+
+        vector<uint64_t> counts;
+        uint64_t sum = 0;
+};
+
+// Zipfian over [0, n) as in YCSB (Gray et al.), hot items scattered over the key space by a hash
+class ZipfianGenerator {
+    public:
+        ZipfianGenerator(uint64_t n, double theta = 0.99) : n(n), theta(theta) {
+            zeta_n = Zeta(n);
+            alpha = 1 / (1 - theta);
+            eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - Zeta(2) / zeta_n);
+        }
+
+        uint64_t Next(std::mt19937_64& rng) {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            double uz = u * zeta_n;
+            uint64_t rank;
+            if(uz < 1) {
+                rank = 0;
+            }
+            else if(uz < 1 + std::pow(0.5, theta)) {
+                rank = 1;
+            }
+            else {
+                rank = n * std::pow(eta * u - eta + 1, alpha);
+            }
+            return Scramble(std::min(rank, n - 1)) % n;
+        }
+
+    private:
+        double Zeta(uint64_t count) {
+            double sum = 0;
+            for(uint64_t i = 1; i <= count; i++) {
+                sum += 1 / std::pow(i, theta);
+            }
+            return sum;
+        }
+
+        // FNV-1a over the bytes of the rank
+        static uint64_t Scramble(uint64_t value) {
+            uint64_t hash = 0xcbf29ce484222325;
+            for(int i = 0; i < 8; i++) {
+                hash ^= (value >> (i * 8)) & 0xff;
+                hash *= 0x100000001b3;
+            }
+            return hash;
+        }
+
+        uint64_t n;
+        double theta;
+        double zeta_n;
+        double alpha;
+        double eta;
+};
+
+// Key order matches index order so sequential inserts append
+static void SetTreeKey(uint64_t index, vector<uint8_t>& key) {
+    key.resize(8);
+    for(int i = 0; i < 8; i++) {
+        key[i] = index >> (56 - i * 8);
+    }
+}
+
+static vector<uint8_t> TreeKey(uint64_t index) {
+    vector<uint8_t> key;
+    SetTreeKey(index, key);
+    return key;
+}
+
+// Primary keys of the DB are 32 bit
+static uint32_t RowKey(uint64_t index) {
+    return index;
+}
+
+static vector<uint8_t> Value(uint64_t index, uint64_t size) {
+    vector<uint8_t> value(size);
+    for(uint64_t i = 0; i < size; i++) {
+        value[i] = 'a' + (index + i) % 26;
+    }
+    return value;
+}
+
+static vector<std::any> RowValues(uint64_t index, uint64_t size) {
+    vector<uint8_t> value = Value(index, size);
+    return {index, string(value.begin(), value.end())};
+}
+
+static PageIOOptions IOOptions(const Config& config) {
+    PageIOOptions options(PageIOType::MMAP);
+    if(config.io == "pread") {
+        options = PageIOOptions(PageIOType::PREAD);
+    }
+    if(config.io == "direct") {
+        options = PageIOOptions(PageIOType::PREAD_DIRECT);
+    }
+    options.page_size = config.page_size;
+    return options;
+}
+
+// Single operations of a workload, implemented for each target
+class Target {
+    public:
+        virtual ~Target() = default;
+        // Bulk loads keys [0, n) before the timed part
+        virtual void Load(uint64_t n, uint64_t value_size) = 0;
+        // Called on each worker thread before its first operation
+        virtual void StartThread(uint64_t thread) = 0;
+        virtual void Put(uint64_t thread, uint64_t index, uint64_t value_size) = 0;
+        virtual void Get(uint64_t thread, uint64_t index) = 0;
+        virtual void Delete(uint64_t thread, uint64_t index) = 0;
+        // Commits writes left in an unfinished batch
+        virtual void FinishThread(uint64_t thread) = 0;
+        virtual EngineStats Stats() = 0;
+};
+
+// Writes go through WriteBatch so threads share commits, reads from other threads go through snapshots
+class TreeTarget : public Target {
+    public:
+        TreeTarget(string filename, const Config& config, uint64_t n_threads) : tree(filename, 64, DEFAULT_CACHE_BYTES, IOOptions(config)) {
+            batch_size = config.batch;
+            batches.resize(n_threads);
+            snapshots.resize(n_threads);
+            reads.assign(n_threads, 0);
+            keys.resize(n_threads);
+            values.resize(n_threads);
+        }
+
+        void Load(uint64_t n, uint64_t value_size) override {
+            vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries;
+            entries.reserve(n);
+            for(uint64_t i = 0; i < n; i++) {
+                entries.push_back({TreeKey(i), Value(i, value_size)});
+            }
+            tree.BulkLoad(entries.begin(), entries.end());
+        }
+
+        void StartThread(uint64_t thread) override {
+            snapshots[thread] = std::make_unique<Snapshot>(tree.GetSnapshot());
+        }
+
+        void Put(uint64_t thread, uint64_t index, uint64_t value_size) override {
+            batches[thread].Put(TreeKey(index), Value(index, value_size));
+            CommitIfFull(thread);
+        }
+
+        // Snapshots are renewed now and then so readers see recent writes and old pages can be reused
+        void Get(uint64_t thread, uint64_t index) override {
+            if(++reads[thread] % 256 == 0) {
+                snapshots[thread].reset();
+                snapshots[thread] = std::make_unique<Snapshot>(tree.GetSnapshot());
+            }
+            SetTreeKey(index, keys[thread]);
+            snapshots[thread]->Get(keys[thread], values[thread]);
+        }
+
+        void Delete(uint64_t thread, uint64_t index) override {
+            batches[thread].Delete(TreeKey(index));
+            CommitIfFull(thread);
+        }
+
+        void FinishThread(uint64_t thread) override {
+            if(!batches[thread].ops.empty()) {
+                tree.Write(batches[thread]);
+                batches[thread].ops.clear();
+            }
+            snapshots[thread].reset();
+        }
+
+        EngineStats Stats() override {
+            return tree.Stats();
+        }
+
+    private:
+        void CommitIfFull(uint64_t thread) {
+            if(batches[thread].ops.size() >= batch_size) {
+                tree.Write(batches[thread]);
+                batches[thread].ops.clear();
+            }
+        }
+
+        BPlusTree tree;
+        uint64_t batch_size;
+        vector<WriteBatch> batches;
+        vector<std::unique_ptr<Snapshot>> snapshots;
+        vector<uint64_t> reads;
+        vector<vector<uint8_t>> keys;
+        vector<vector<uint8_t>> values;
+};
+
+// One table per thread, each in its own tree so writers run in parallel
+// Transactions span every table, so batches are only used with a single thread
+class DBTarget : public Target {
+    public:
+        DBTarget(string filename, const Config& config, uint64_t n_threads) : db(filename, true, IOOptions(config)) {
+            batch_size = n_threads == 1 ? config.batch : 1;
+            pending.assign(n_threads, 0);
+            for(uint64_t i = 0; i < n_threads; i++) {
+                string name = "bench" + std::to_string(i);
+                db.CreateTable(Table(name, 10 + i, {DataType::INTEGER, DataType::STRING}, {"id", "payload"}));
+                tables.push_back(db.OpenTable(name));
+            }
+        }
+
+        // Every thread's table gets all keys, workers pick keys from the whole range
+        void Load(uint64_t n, uint64_t value_size) override {
+            for(uint64_t t = 0; t < tables.size(); t++) {
+                vector<std::pair<uint32_t, vector<std::any>>> rows;
+                rows.reserve(n);
+                for(uint64_t i = 0; i < n; i++) {
+                    rows.push_back({RowKey(i), RowValues(i, value_size)});
+                }
+                db.BulkInsertRows("bench" + std::to_string(t), rows);
+            }
+        }
+
+        void StartThread(uint64_t thread) override {
+            if(batch_size > 1) {
+                db.BeginTransaction();
+            }
+        }
+
+        void Put(uint64_t thread, uint64_t index, uint64_t value_size) override {
+            db.InsertRow(tables[thread], RowKey(index), RowValues(index, value_size));
+            CommitIfFull(thread);
+        }
+
+        void Get(uint64_t thread, uint64_t index) override {
+            db.GetRow(tables[thread], RowKey(index));
+        }
+
+        void Delete(uint64_t thread, uint64_t index) override {
+            db.DeleteRow(tables[thread], RowKey(index));
+            CommitIfFull(thread);
+        }
+
+        void FinishThread(uint64_t thread) override {
+            if(batch_size > 1) {
+                db.CommitTransaction();
+            }
+        }
+
+        EngineStats Stats() override {
+            return db.Stats();
+        }
+
+    private:
+        void CommitIfFull(uint64_t thread) {
+            if(batch_size > 1 && ++pending[thread] % batch_size == 0) {
+                db.CommitTransaction();
+                db.BeginTransaction();
+            }
+        }
+
+        DB db;
+        uint64_t batch_size;
+        vector<TableHandle> tables;
+        vector<uint64_t> pending;
+};
+
+struct Result {
+    Run run;
+    uint64_t ops;
+    double seconds;
+    Histogram latency;
+    uint64_t allocations;
+    uint64_t file_bytes;
+    // Engine counters over the timed part
+    EngineStats stats;
+};
+
+static uint64_t Elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result RunWorkload(const Config& config, const Run& run) {
+    string filename = config.dir + "/database_bench." + std::to_string(getpid());
+    std::filesystem::remove(filename);
+
+    Result result{run, 0, 0, {}, 0, 0, {}};
+    {
+        std::unique_ptr<Target> target;
+        if(run.target == "db") {
+            target = std::make_unique<DBTarget>(filename, config, run.threads);
+        }
+        else {
+            target = std::make_unique<TreeTarget>(filename, config, run.threads);
+        }
+
+        bool inserting = run.workload == "insert_seq" || run.workload == "insert_rand";
+        if(!inserting) {
+            target->Load(config.keys, run.value_size);
+        }
+
+        // Keys each thread inserts or deletes, disjoint between threads
+        uint64_t key_space = inserting ? config.ops : config.keys;
+        vector<uint64_t> order(run.workload == "delete" ? config.keys : config.ops);
+        std::iota(order.begin(), order.end(), 0);
+        if(run.workload == "insert_rand" || run.workload == "delete") {
+            std::mt19937_64 rng(42);
+            std::shuffle(order.begin(), order.end(), rng);
+        }
+        order.resize(std::min<uint64_t>(order.size(), config.ops));
+
+        EngineStats before = target->Stats();
+        vector<Histogram> histograms(run.threads);
+        uint64_t per_thread = order.size() / run.threads;
+        uint64_t allocations_before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        vector<std::thread> workers;
+        for(uint64_t t = 0; t < run.threads; t++) {
+            workers.emplace_back([&, t]() {
+                std::mt19937_64 rng(1000 + t);
+                ZipfianGenerator zipfian(key_space);
+                auto pick = [&]() {
+                    if(config.dist == "zipfian") {
+                        return zipfian.Next(rng);
+                    }
+                    return std::uniform_int_distribution<uint64_t>(0, key_space - 1)(rng);
+                };
+                target->StartThread(t);
+                for(uint64_t i = t * per_thread; i < (t + 1) * per_thread; i++) {
+                    bool read = std::uniform_real_distribution<double>(0, 1)(rng) < config.read_ratio;
+                    auto op_start = std::chrono::steady_clock::now();
+                    if(inserting) {
+                        target->Put(t, order[i], run.value_size);
+                    }
+                    else if(run.workload == "get" || (run.workload == "mixed" && read)) {
+                        target->Get(t, pick());
+                    }
+                    else if(run.workload == "delete") {
+                        target->Delete(t, order[i]);
+                    }
+                    else {
+                        target->Put(t, pick(), run.value_size);
+                    }
+                    histograms[t].Record(Elapsed(op_start));
+                }
+                target->FinishThread(t);
+            });
+        }
+        for(auto& worker : workers) {
+            worker.join();
+        }
+        result.seconds = Elapsed(start) / 1e9;
+        result.allocations = allocations.load() - allocations_before;
+        for(auto& histogram : histograms) {
+            result.latency.Merge(histogram);
+        }
+        result.ops = result.latency.total;
+        EngineStats after = target->Stats();
+        result.stats = after;
+        result.stats.pages_read -= before.pages_read;
+        result.stats.pages_written -= before.pages_written;
+        result.stats.syncs -= before.syncs;
+        result.stats.bytes_synced -= before.bytes_synced;
+        result.stats.file_grows -= before.file_grows;
+        result.stats.node_splits -= before.node_splits;
+        result.stats.node_merges -= before.node_merges;
+    }
+    result.file_bytes = std::filesystem::file_size(filename);
+    std::filesystem::remove(filename);
+    return result;
+}
+
+static void PrintResult(const Result& result) {
+    std::cout << std::left << std::setw(5) << result.run.target
+        << std::setw(12) << result.run.workload
+        << "value " << std::setw(6) << result.run.value_size
+        << "threads " << std::setw(3) << result.run.threads
+        << std::right << std::fixed << std::setprecision(0)
+        << std::setw(10) << result.ops / result.seconds << " ops/s"
+        << "  p50 " << std::setw(8) << result.latency.Percentile(0.5) / 1000.0
+        << std::setprecision(1)
+        << "  p99 " << std::setw(9) << result.latency.Percentile(0.99) / 1000.0
+        << "  p999 " << std::setw(9) << result.latency.Percentile(0.999) / 1000.0
+        << "  max " << std::setw(9) << result.latency.max / 1000.0 << " us"
+        << "  allocs/op " << std::setw(6) << double(result.allocations) / result.ops << std::endl;
+}
+
+static void WriteJson(const Config& config, const vector<Result>& results) {
+    std::ofstream out(config.json);
+    out << "{\n  \"version\": \"" << BENCH_VERSION << "\",\n";
+    out << "  \"config\": {\"keys\": " << config.keys << ", \"ops\": " << config.ops
+        << ", \"dist\": \"" << config.dist << "\", \"read_ratio\": " << config.read_ratio
+        << ", \"batch\": " << config.batch << ", \"io\": \"" << config.io << "\", \"page_size\": " << config.page_size << "},\n";
+    out << "  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& result = results[i];
+        out << "    {\"target\": \"" << result.run.target << "\", \"workload\": \"" << result.run.workload
+            << "\", \"value_size\": " << result.run.value_size << ", \"threads\": " << result.run.threads
+            << ", \"ops\": " << result.ops << ", \"seconds\": " << result.seconds
+            << ", \"ops_per_sec\": " << result.ops / result.seconds
+            << ", \"latency_ns\": {\"mean\": " << result.latency.Mean()
+            << ", \"p50\": " << result.latency.Percentile(0.5)
+            << ", \"p99\": " << result.latency.Percentile(0.99)
+            << ", \"p999\": " << result.latency.Percentile(0.999)
+            << ", \"max\": " << result.latency.max << "}"
+            << ", \"allocations_per_op\": " << double(result.allocations) / result.ops
+            << ", \"file_bytes\": " << result.file_bytes
+            << ", \"engine\": {\"pages_read\": " << result.stats.pages_read
+            << ", \"pages_written\": " << result.stats.pages_written
+            << ", \"syncs\": " << result.stats.syncs
+            << ", \"bytes_synced\": " << result.stats.bytes_synced
+            << ", \"file_grows\": " << result.stats.file_grows
+            << ", \"node_splits\": " << result.stats.node_splits
+            << ", \"node_merges\": " << result.stats.node_merges << "}}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+static vector<string> SplitList(const string& list) {
+    vector<string> items;
+    std::stringstream stream(list);
+    string item;
+    while(std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static vector<uint64_t> SplitNumbers(const string& list) {
+    vector<uint64_t> numbers;
+    for(auto& item : SplitList(list)) {
+        numbers.push_back(std::stoull(item));
+    }
+    return numbers;
+}
+
+static bool ParseArguments(int argc, char** argv, Config& config) {
+    for(int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if(flag == "--target") config.targets = SplitList(value);
+        else if(flag == "--workload") config.workloads = SplitList(value);
+        else if(flag == "--keys") config.keys = std::stoull(value);
+        else if(flag == "--ops") config.ops = std::stoull(value);
+        else if(flag == "--value-size") config.value_sizes = SplitNumbers(value);
+        else if(flag == "--threads") config.threads = SplitNumbers(value);
+        else if(flag == "--dist") config.dist = value;
+        else if(flag == "--read-ratio") config.read_ratio = std::stod(value);
+        else if(flag == "--batch") config.batch = std::max<uint64_t>(1, std::stoull(value));
+        else if(flag == "--io") config.io = value;
+        else if(flag == "--page-size") config.page_size = std::stoull(value);
+        else if(flag == "--dir") config.dir = value;
+        else if(flag == "--json") config.json = value;
+        else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+    if(argc % 2 == 0) {
+        std::cerr << "Missing value for " << argv[argc - 1] << std::endl;
+        return false;
+    }
+    if(!IsValidPageSize(config.page_size)) {
+        std::cerr << "Page size must be a power of two from " << MIN_PAGE_SIZE << " to " << MAX_PAGE_SIZE << std::endl;
+        return false;
+    }
+    for(auto size : config.value_sizes) {
+        if(size > config.page_size / 4) {
+            std::cerr << "Values over " << config.page_size / 4 << " bytes do not fit in a node" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Config config;
+    if(!ParseArguments(argc, argv, config)) {
+        return 1;
+    }
+
+    vector<Result> results;
+    for(auto& target : config.targets) {
+        for(auto& workload : config.workloads) {
+            for(auto value_size : config.value_sizes) {
+                for(auto threads : config.threads) {
+                    results.push_back(RunWorkload(config, {target, workload, value_size, threads}));
+                    PrintResult(results.back());
+                }
+            }
+        }
+    }
+    if(!config.json.empty()) {
+        WriteJson(config, results);
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "aggregate.hpp"
+#include <algorithm>
+#include <cstdint>
+#include "bitutils.hpp"
+#include "row.hpp"
+
+void AggregateResult::Merge(const AggregateResult& other) {
+    rows += other.rows;
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+// Loops below always cover the whole batch, rows past the end have matched cleared
+// A constant trip count and no branches let them vectorize without a scalar tail
+// 64 bit compares need AVX2 on x86, so GCC also builds an AVX2 copy picked at load time when the CPU has it
+// The load time pick runs before ThreadSanitizer is set up, so its builds keep the plain loops
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__) && !defined(__SANITIZE_THREAD__)
+#define SIMD_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_KERNEL
+#endif
+
+SIMD_KERNEL static void FilterColumn(const uint64_t* __restrict values, uint64_t* __restrict matched, CompareOp op, uint64_t operand) {
+    switch(op) {
+        case CompareOp::EQUAL:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] == operand;
+            }
+            break;
+        case CompareOp::NOT_EQUAL:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] != operand;
+            }
+            break;
+        case CompareOp::LESS:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] < operand;
+            }
+            break;
+        case CompareOp::LESS_EQUAL:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] <= operand;
+            }
+            break;
+        case CompareOp::GREATER:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] > operand;
+            }
+            break;
+        case CompareOp::GREATER_EQUAL:
+            for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+                matched[i] &= values[i] >= operand;
+            }
+            break;
+    }
+}
+
+SIMD_KERNEL static void AggregateColumn(const uint64_t* values, const uint64_t* matched, const uint64_t* present, AggregateResult& result) {
+    uint64_t rows = 0, count = 0, sum = 0, min = UINT64_MAX, max = 0;
+    for(int i = 0; i < AGGREGATE_BATCH_ROWS; i++) {
+        uint64_t selected = matched[i] & present[i];
+        uint64_t mask = 0 - selected;
+        rows += matched[i];
+        count += selected;
+        sum += values[i] & mask;
+        min = std::min(min, values[i] | ~mask);
+        max = std::max(max, values[i] & mask);
+    }
+    result.Merge({rows, count, sum, min, max});
+}
+
+AggregateBatch::AggregateBatch(const Table& table, std::string column_name, const vector<IntegerPredicate>& predicates) : table(table) {
+    auto& names = table.column_names;
+    AddColumn(std::find(names.begin(), names.end(), column_name) - names.begin());
+    for(auto& predicate : predicates) {
+        uint16_t column = std::find(names.begin(), names.end(), predicate.column) - names.begin();
+        filters.push_back({column, predicate.op, predicate.value});
+        AddColumn(column);
+    }
+    // Rows of the table all have the same fixed part, see RowView
+    fixed_end = 2 + (table.schema.size() + 7) / 8 + table.fixed_columns * sizeof(uint64_t);
+    size = 0;
+    values.assign(columns.size(), vector<uint64_t>(AGGREGATE_BATCH_ROWS, 0));
+    matched.assign(AGGREGATE_BATCH_ROWS, 0);
+    present.assign(AGGREGATE_BATCH_ROWS, 0);
+}
+
+void AggregateBatch::AddColumn(uint16_t column) {
+    columns.push_back(column);
+    slot_offsets.push_back(2 + (table.schema.size() + 7) / 8 + table.column_slots[column] * sizeof(uint64_t));
+}
+
+// Reads the fixed slots straight from the row instead of through a RowView
+// Rows that do not match the schema are skipped, NULLs are stored as 0 with matched or present cleared
+void AggregateBatch::Add(span<const uint8_t> row) {
+    if(row.size() < fixed_end || row[0] != ROW_FORMAT_VERSION || row[1] != table.schema.size()) {
+        return;
+    }
+    matched[size] = 1;
+    for(size_t i = 0; i < columns.size(); i++) {
+        bool null = (row[2 + columns[i] / 8] >> (columns[i] % 8)) & 1;
+        values[i][size] = null ? 0 : FromCharPointer<uint64_t>(row.data() + slot_offsets[i]);
+        if(i == 0) {
+            present[size] = !null;
+        }
+        else {
+            matched[size] &= !null;
+        }
+    }
+    if(++size == AGGREGATE_BATCH_ROWS) {
+        Evaluate();
+    }
+}
+
+void AggregateBatch::Evaluate() {
+    for(size_t i = 0; i < filters.size(); i++) {
+        FilterColumn(values[i + 1].data(), matched.data(), filters[i].op, filters[i].value);
+    }
+    AggregateColumn(values[0].data(), matched.data(), present.data(), result);
+    std::fill(matched.begin(), matched.end(), 0);
+    std::fill(present.begin(), present.end(), 0);
+    size = 0;
+}
+
+AggregateResult AggregateBatch::Finish() {
+    if(size > 0) {
+        Evaluate();
+    }
+    return result;
+}
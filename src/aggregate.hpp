@@ -0,0 +1,80 @@
+#ifndef AGGREGATE
+#define AGGREGATE
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+#include "table.hpp"
+
+using std::span;
+using std::vector;
+
+// Rows are decoded a batch at a time into an array per column, predicates and aggregates then run
+// over whole batches in loops without branches, which the compiler turns into SIMD code
+#define AGGREGATE_BATCH_ROWS 1024
+
+enum CompareOp : uint8_t {
+    EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL
+};
+
+// column op value on an INTEGER column, rows with the column NULL never match
+struct IntegerPredicate {
+    std::string column;
+    CompareOp op;
+    uint64_t value;
+};
+
+// rows matched every predicate, count of them have the aggregated column not NULL
+// sum wraps around like uint64_t, min and max are only meaningful when count > 0
+struct AggregateResult {
+    uint64_t rows = 0;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+
+    void Merge(const AggregateResult& other);
+};
+
+// COUNT, SUM, MIN and MAX of one INTEGER column over encoded rows of a table
+// The caller checks that the columns exist and are INTEGER
+class AggregateBatch {
+    public:
+        AggregateBatch(const Table& table, std::string column_name, const vector<IntegerPredicate>& predicates);
+
+        void Add(span<const uint8_t> row);
+        // Evaluates the rows still in the batch, the total over every row added
+        AggregateResult Finish();
+
+    private:
+        struct Filter {
+            uint16_t column;
+            CompareOp op;
+            uint64_t value;
+        };
+
+        void Evaluate();
+        // Every column read, the aggregated one first, with the offset of its fixed slot in the row
+        void AddColumn(uint16_t column);
+
+        const Table& table;
+        vector<uint16_t> columns;
+        vector<uint16_t> slot_offsets;
+        uint64_t fixed_end;
+        vector<Filter> filters;
+        uint16_t size;
+        // values[i] holds columns[i]
+        vector<vector<uint64_t>> values;
+        // 1 or 0 per row, as wide as the values so the loops keep one element size
+        vector<uint64_t> matched;
+        vector<uint64_t> present;
+        AggregateResult result;
+};
+
+#endif
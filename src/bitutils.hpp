@@ -10,6 +10,12 @@ template<typename T> vector<uint8_t> ToCharVector(T value) {
     return serialized;
 }
 
+template<typename T> void ToCharPointer(T value, uint8_t* serialized) {
+    for(int i = 0; i < sizeof(T); i++) {
+        serialized[i] = value >> (sizeof(T) - i - 1)*8;
+    }
+}
+
 template<typename T> T FromCharVector(vector<uint8_t> serialized) {
     T value{};
     for(int i = 0; i < sizeof(T); i++) {
@@ -18,7 +24,7 @@ template<typename T> T FromCharVector(vector<uint8_t> serialized) {
     return value;
 }
 
-template<typename T> T FromCharPointer(uint8_t* serialized) {
+template<typename T> T FromCharPointer(const uint8_t* serialized) {
     T value{};
     for(int i = 0; i < sizeof(T); i++) {
         value += ((T)serialized[i]) << (sizeof(T) - i - 1)*8;
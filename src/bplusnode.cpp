@@ -1,5 +1,6 @@
 #include "bplusnode.hpp"
 #include "bitutils.hpp"
+#include "nodeview.hpp"
 #include <cstdint>
 #include <iostream>
 #include <sys/types.h>
@@ -8,176 +9,179 @@ BPlusNode::BPlusNode(BNodeType type) {
     this->type = type;
 }
 
-uint16_t BPlusNode::GetBytes() {
-    uint16_t key_val_sum = 0;
+// Keys are sorted, so the prefix shared by all of them is the one shared by the first and last
+uint16_t BPlusNode::PrefixLength() const {
+    if(type == BNodeType::LEAF) {
+        if(value_map.empty()) {
+            return 0;
+        }
+        return CommonPrefixLength(value_map.begin()->first, value_map.rbegin()->first);
+    }
+    if(pointer_map.empty()) {
+        return 0;
+    }
+    return CommonPrefixLength(pointer_map.begin()->first, pointer_map.rbegin()->first);
+}
+
+uint32_t BPlusNode::GetBytes() const {
+    uint32_t key_val_sum = 0;
+    uint16_t prefix_length = PrefixLength();
 
-    for(auto key_val : value_map) {
-        key_val_sum += key_val.first.size() + key_val.second.size();
+    for(auto& key_val : value_map) {
+        key_val_sum += key_val.first.size() - prefix_length + key_val.second.size();
     }
-    for(auto key_val : pointer_map) {
-        key_val_sum += key_val.first.size() + 8;
+    for(auto& key_val : pointer_map) {
+        key_val_sum += key_val.first.size() - prefix_length + 8 + 8; // pointer and key head
     }
 
-    return 3 + value_map.size() * 2 + pointer_map.size() * 2 + key_val_sum;
+    // Offset arrays carry one extra end offset each
+    return 5 + prefix_length + (value_map.size() + pointer_map.size() + 1) * 4 + key_val_sum;
 }
 
-bool BPlusNode::HasKey(vector<uint8_t> key) {
-    if(value_map.count(key) > 0 || pointer_map.count(key) > 0) {
-        return true;
-    }
-    return false;
+bool BPlusNode::HasKey(span<const uint8_t> key) {
+    return value_map.find(key) != value_map.end() || pointer_map.find(key) != pointer_map.end();
 }
 
-BPlusNode BPlusNode::InsertKV(vector<uint8_t> key, vector<uint8_t> value) {
-    value_map[key] = value;
+map<vector<uint8_t>, uint64_t, KeyLess>::iterator BPlusNode::FindChild(span<const uint8_t> key) {
+    auto child = pointer_map.upper_bound(key);
+    if(child == pointer_map.begin()) {
+        return child;
+    }
+    return --child;
+}
 
+BPlusNode& BPlusNode::InsertKV(vector<uint8_t> key, vector<uint8_t> value) {
+    value_map.insert_or_assign(std::move(key), std::move(value));
     return *this;
 }
 
-BPlusNode BPlusNode::InsertKV(vector<uint8_t> key, uint64_t pointer) {
-    pointer_map[key] = pointer;
-
+BPlusNode& BPlusNode::InsertKV(vector<uint8_t> key, uint64_t pointer) {
+    pointer_map.insert_or_assign(std::move(key), pointer);
     return *this;
 }
 
-BPlusNode BPlusNode::UpdateKV(vector<uint8_t> key, vector<uint8_t> value) {
-    value_map[key] = value;
-    return *this;
+BPlusNode& BPlusNode::UpdateKV(vector<uint8_t> key, vector<uint8_t> value) {
+    return InsertKV(std::move(key), std::move(value));
 }
 
-BPlusNode BPlusNode::UpdateKV(vector<uint8_t> key, uint64_t pointer) {
-    pointer_map[key] = pointer;
-    return *this;
+BPlusNode& BPlusNode::UpdateKV(vector<uint8_t> key, uint64_t pointer) {
+    return InsertKV(std::move(key), pointer);
 }
 
-BPlusNode BPlusNode::DeleteKV(vector<uint8_t> key) {
+BPlusNode& BPlusNode::DeleteKV(span<const uint8_t> key) {
     if(type == BNodeType::NODE) {
-        pointer_map.erase(key);
+        auto entry = pointer_map.find(key);
+        if(entry != pointer_map.end()) {
+            pointer_map.erase(entry);
+        }
     }
     else {
-        value_map.erase(key);
+        auto entry = value_map.find(key);
+        if(entry != value_map.end()) {
+            value_map.erase(entry);
+        }
     }
     return *this;
 }
 
+// Written in one pass into a buffer of the final size
 vector<uint8_t> BPlusNode::Serialize() {
-    vector<uint8_t> serialized;
-    serialized.reserve(4096);
-
-    serialized.push_back(type);
     uint16_t key_count = value_map.size() + pointer_map.size();
-    serialized.push_back(key_count >> 8);
-    serialized.push_back(key_count);
+    uint16_t prefix_length = PrefixLength();
+    vector<uint8_t> serialized(GetBytes());
 
-    vector<uint16_t> key_offsets;
-    vector<uint16_t> value_offsets;
-    vector<uint8_t> serialized_keys{};
-    vector<uint8_t> serialized_values{};
+    serialized[0] = type;
+    ToCharPointer(key_count, serialized.data() + 1);
+    ToCharPointer(prefix_length, serialized.data() + 3);
 
-    uint16_t cumulative_key_offset = 0;
-    uint16_t cumulative_value_offset = 0;
-    if(type == BNodeType::NODE) {
-        for(auto key_pointer : pointer_map) {
-            key_offsets.push_back(cumulative_key_offset);
-            value_offsets.push_back(cumulative_value_offset);
-            cumulative_key_offset += key_pointer.first.size();
-            cumulative_value_offset += 8;
-            serialized_keys.insert(serialized_keys.end(), key_pointer.first.begin(), key_pointer.first.end());
-            auto pointer = ToCharVector(key_pointer.second);
-            serialized_values.insert(serialized_values.end(), pointer.begin(), pointer.end());
-        }
-        key_offsets.push_back(cumulative_key_offset);
-        value_offsets.push_back(cumulative_value_offset);
+    // Shared key prefix, keys below only store what follows it
+    if(prefix_length > 0) {
+        const vector<uint8_t>& first_key = type == BNodeType::NODE ? pointer_map.begin()->first : value_map.begin()->first;
+        std::copy(first_key.begin(), first_key.begin() + prefix_length, serialized.begin() + 5);
+    }
 
-        // Start serializing
-        for(auto ko : key_offsets) {
-            auto key_offset = ToCharVector(ko);
-            serialized.insert(serialized.end(), key_offset.begin(), key_offset.end());
-        }
-        for(auto vo : value_offsets) {
-            auto value_offset = ToCharVector(static_cast<uint16_t>(vo + key_offsets.back()));
-            serialized.insert(serialized.end(), value_offset.begin(), value_offset.end());
+    uint8_t* key_offsets = serialized.data() + 5 + prefix_length;
+    uint8_t* value_offsets = key_offsets + (key_count + 1) * 2;
+    uint8_t* key_heads = value_offsets + (key_count + 1) * 2;
+    uint8_t* keys = key_heads + (type == BNodeType::NODE ? key_count * 8 : 0);
+    uint16_t keys_length = 0;
+    for(auto& key_pointer : pointer_map) {
+        keys_length += key_pointer.first.size() - prefix_length;
+    }
+    for(auto& key_value : value_map) {
+        keys_length += key_value.first.size() - prefix_length;
+    }
+    uint8_t* values = keys + keys_length;
+
+    // Value offsets count from the start of the keys
+    uint16_t key_offset = 0;
+    uint16_t value_offset = keys_length;
+    uint16_t index = 0;
+    auto add_key = [&](const vector<uint8_t>& key) {
+        ToCharPointer(key_offset, key_offsets + index * 2);
+        ToCharPointer(value_offset, value_offsets + index * 2);
+        std::copy(key.begin() + prefix_length, key.end(), keys + key_offset);
+        key_offset += key.size() - prefix_length;
+    };
+    if(type == BNodeType::NODE) {
+        for(auto& key_pointer : pointer_map) {
+            add_key(key_pointer.first);
+            ToCharPointer(KeyHead(span<const uint8_t>(key_pointer.first).subspan(prefix_length)), key_heads + index * 8);
+            ToCharPointer(key_pointer.second, values + value_offset - keys_length);
+            value_offset += 8;
+            index++;
         }
-        serialized.insert(serialized.end(), serialized_keys.begin(), serialized_keys.end());
-        serialized.insert(serialized.end(), serialized_values.begin(), serialized_values.end());
     }
     else {
-        for(auto key_value : value_map) {
-            key_offsets.push_back(cumulative_key_offset);
-            value_offsets.push_back(cumulative_value_offset);
-            cumulative_key_offset += key_value.first.size();
-            cumulative_value_offset += key_value.second.size();
-            serialized_keys.insert(serialized_keys.end(), key_value.first.begin(), key_value.first.end());
-            serialized_values.insert(serialized_values.end(), key_value.second.begin(), key_value.second.end());
-        }
-        key_offsets.push_back(cumulative_key_offset);
-        value_offsets.push_back(cumulative_value_offset);
-
-        // Start serializing
-        for(auto ko : key_offsets) {
-            auto key_offset = ToCharVector(ko);
-            serialized.insert(serialized.end(), key_offset.begin(), key_offset.end());
-        }
-        for(auto vo : value_offsets) {
-            auto value_offset = ToCharVector(static_cast<uint16_t>(vo + key_offsets.back()));
-            serialized.insert(serialized.end(), value_offset.begin(), value_offset.end());
+        for(auto& key_value : value_map) {
+            add_key(key_value.first);
+            std::copy(key_value.second.begin(), key_value.second.end(), values + value_offset - keys_length);
+            value_offset += key_value.second.size();
+            index++;
         }
-        serialized.insert(serialized.end(), serialized_keys.begin(), serialized_keys.end());
-        serialized.insert(serialized.end(), serialized_values.begin(), serialized_values.end());
     }
+    ToCharPointer(key_offset, key_offsets + index * 2);
+    ToCharPointer(value_offset, value_offsets + index * 2);
     return serialized;
 }
 
-// Deserialize constructor
-BPlusNode::BPlusNode(uint8_t* data) {
-    // this->node_pointer = data;
-
-    vector<vector<uint8_t>> keys, values;
-    vector<uint64_t> pointers;
-
+// Deserialize constructor, entries arrive in key order and are appended at the end of the map
+BPlusNode::BPlusNode(const uint8_t* data) {
     type = static_cast<BNodeType>(data[0]);
 
     uint16_t key_count = 0;
     key_count += data[1] << 8;
     key_count += data[2];
 
+    uint16_t prefix_length = (data[3] << 8) + data[4];
+    const uint8_t* prefix = data + 5;
+    data += prefix_length + 2; // offsets below are relative to a 3 byte header
+
     uint16_t keys_start = 3 + (key_count + 1) * 4;
-    for(int i = 0; i < key_count * 2; i += 2) {
-        uint16_t start_offset = (data[i + 3] << 8) + data[i + 4];
-        uint16_t end_offset = (data[i + 5] << 8) + data[i + 6];
-        vector<uint8_t> key;
-        key.reserve(end_offset - start_offset);
-        std::copy(data + keys_start + start_offset, data + keys_start + end_offset, std::back_inserter(key));
-        keys.push_back(key);
+    if(type == BNodeType::NODE) {
+        keys_start += key_count * 8; // skip key heads
     }
     uint16_t values_offsets = 3 + (key_count + 1) * 2;
     for(int i = 0; i < key_count * 2; i += 2) {
-        uint16_t start_offset = (data[i + values_offsets] << 8) + data[i + values_offsets + 1];
-        uint16_t end_offset = (data[i + values_offsets + 2] << 8) + data[i + values_offsets + 3];
+        uint16_t key_start = (data[i + 3] << 8) + data[i + 4];
+        uint16_t key_end = (data[i + 5] << 8) + data[i + 6];
+        vector<uint8_t> key;
+        key.reserve(prefix_length + key_end - key_start);
+        key.insert(key.end(), prefix, prefix + prefix_length);
+        key.insert(key.end(), data + keys_start + key_start, data + keys_start + key_end);
+
+        uint16_t value_start = (data[i + values_offsets] << 8) + data[i + values_offsets + 1];
+        uint16_t value_end = (data[i + values_offsets + 2] << 8) + data[i + values_offsets + 3];
         if(type == BNodeType::LEAF) {
-            vector<uint8_t> value;
-            value.reserve(end_offset - start_offset);
-            std::copy(data + keys_start + start_offset, data + keys_start + end_offset, std::back_inserter(value));
-            values.push_back(value);
+            value_map.emplace_hint(value_map.end(), std::move(key), vector<uint8_t>(data + keys_start + value_start, data + keys_start + value_end));
         }
         else {
-            pointers.push_back(FromCharPointer<uint64_t>(data + keys_start + start_offset));
-        }
-    }
-
-    if(type == BNodeType::LEAF) {
-        for(int i = 0; i < key_count; i++) {
-            value_map[keys[i]] = values[i];
-        }
-    }
-    else {
-        for(int i = 0; i < key_count; i++) {
-            pointer_map[keys[i]] = pointers[i];
+            pointer_map.emplace_hint(pointer_map.end(), std::move(key), FromCharPointer<uint64_t>(data + keys_start + value_start));
         }
     }
 }
 
-void BPlusNode::PrintNodeData() {
+void BPlusNode::PrintNodeData() const {
     std::cout << "Node type: " << (uint)type << ", Pointer: " << (uint64_t)node_pointer << "\n";
     std::cout << "KVs: \n";
 
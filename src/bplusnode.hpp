@@ -1,14 +1,26 @@
 #ifndef BPLUSNODE
 #define BPLUSNODE
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <map>
+#include <span>
 
 using std::map;
+using std::span;
 using std::vector;
 
-#define BNODE_PAGE_SIZE 4096
+// Bytewise key order, transparent so the maps below can be searched with a span without copying it
+struct KeyLess {
+    using is_transparent = void;
+    bool operator()(span<const uint8_t> a, span<const uint8_t> b) const {
+        size_t common = std::min(a.size(), b.size());
+        int order = common == 0 ? 0 : memcmp(a.data(), b.data(), common);
+        return order < 0 || (order == 0 && a.size() < b.size());
+    }
+};
 
 enum BNodeType : uint8_t {
     NODE,
@@ -20,39 +32,41 @@ class BPlusNode {
     public:
         BPlusNode(BNodeType type);
         BPlusNode(vector<uint8_t> data);
-        BPlusNode(uint8_t* data);
-        uint16_t GetBytes();
+        BPlusNode(const uint8_t* data);
+        uint32_t GetBytes() const;
 
 
-        bool HasKey(vector<uint8_t> key);
-        uint16_t FindIndexBefore(vector<uint8_t> key);
+        bool HasKey(span<const uint8_t> key);
+        // Child entry with the last key <= key
+        map<vector<uint8_t>, uint64_t, KeyLess>::iterator FindChild(span<const uint8_t> key);
 
-        BPlusNode InsertKV(vector<uint8_t> key, vector<uint8_t> value);
-        BPlusNode InsertKV(vector<uint8_t> key, uint64_t pointer);
-        BPlusNode DeleteKV(vector<uint8_t> key);
-        BPlusNode UpdateKV(vector<uint8_t> key, vector<uint8_t> value);
-        BPlusNode UpdateKV(vector<uint8_t> key, uint64_t pointer);
+        // Change the node in place and return it, keys and values are moved in
+        BPlusNode& InsertKV(vector<uint8_t> key, vector<uint8_t> value);
+        BPlusNode& InsertKV(vector<uint8_t> key, uint64_t pointer);
+        BPlusNode& DeleteKV(span<const uint8_t> key);
+        BPlusNode& UpdateKV(vector<uint8_t> key, vector<uint8_t> value);
+        BPlusNode& UpdateKV(vector<uint8_t> key, uint64_t pointer);
 
         vector<uint8_t> Serialize();
 
-        void PrintNodeData();
-
-        BPlusNode MergeChildren();
+        void PrintNodeData() const;
     
         BNodeType type;
 
-        map<vector<uint8_t>, vector<uint8_t>> value_map;
-        map<vector<uint8_t>, uint64_t> pointer_map;
+        map<vector<uint8_t>, vector<uint8_t>, KeyLess> value_map;
+        map<vector<uint8_t>, uint64_t, KeyLess> pointer_map;
 
 
         // vector<vector<uint8_t>> keys;
         // vector<uint8_t*> pointers;
         // vector<vector<uint8_t>> values;    
         
-        uint64_t node_pointer;
+        uint64_t node_pointer = 0; // 0 until written
     private:
-        // type | key_count | key_offsets    | value_offsets  | keys | pointers/values |
-        // 1B   | 2B        | key_count * 2B | key_count * 2B | nB   | nB              |
+        uint16_t PrefixLength() const;
+
+        // type | key_count | prefix_len | prefix | key_offsets    | value_offsets  | key_heads (nodes only) | key suffixes | pointers/values |
+        // 1B   | 2B        | 2B         | nB     | key_count * 2B | key_count * 2B | key_count * 8B         | nB           | nB              |
 
 };
 
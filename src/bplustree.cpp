@@ -1,11 +1,13 @@
 #include "bplustree.hpp"
 #include "bitutils.hpp"
 #include "bplusnode.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <fcntl.h>
 #include <iostream>
 #include <iterator>
 #include <ostream>
+#include <stdexcept>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <vector>
@@ -13,190 +15,828 @@
 
 // BPlusTree
 
-BPlusTree::BPlusTree(std::string filename, uint64_t branching_factor) : manager(filename) {
+BPlusTree::BPlusTree(std::string filename, uint64_t branching_factor, uint64_t cache_bytes, PageIOOptions io_options) :
+    BPlusTree(std::make_shared<DiskManager>(filename, cache_bytes, io_options), 0, branching_factor) {
+}
 
+BPlusTree::BPlusTree(std::shared_ptr<DiskManager> manager, uint16_t root_slot, uint64_t branching_factor) {
+    this->manager = manager;
+    this->root_slot = root_slot;
     this->branching_factor = branching_factor;
-    if(manager.GetRoot() != 0) { // load existing
-        root_pointer = manager.GetRoot();
+    page_size = manager->PageSize();
+    merge_threshold = DEFAULT_MERGE_THRESHOLD;
+    overflow_threshold = DEFAULT_OVERFLOW_THRESHOLD;
+    timing_sample = 0;
+    node_splits = 0;
+    node_merges = 0;
+    node_borrows = 0;
+    in_transaction = false;
+    dirty_start = UINT64_MAX;
+    dirty_end = 0;
+    compaction_from = 0;
+    compaction_packing = false;
+    compaction_settling = false;
+    compaction_live_end = 0;
+    if(manager->GetRoot(root_slot) != 0) { // load existing
+        root_pointer = manager->GetRoot(root_slot);
         return;
     }
 
     BPlusNode root_node(BNodeType::LEAF);
     root_node.InsertKV({0}, vector<uint8_t>{0}); // sentinel
-    root_pointer = manager.WriteNode(root_node);
+    root_pointer = WriteNode(std::move(root_node));
+    Commit();
+}
+
+void WriteBatch::Put(vector<uint8_t> key, vector<uint8_t> value) {
+    ops.push_back({WriteOpType::PUT, std::move(key), std::move(value)});
+}
+
+void WriteBatch::Delete(vector<uint8_t> key) {
+    ops.push_back({WriteOpType::DELETE, std::move(key), {}});
+}
+
+// Pages are written without syncing, the dirty range is flushed once on commit
+// The node is handed on to the node cache, callers that still need it pass a copy
+uint64_t BPlusTree::WriteNode(BPlusNode node) {
+    uint64_t page = manager->WriteNode(std::move(node), root_slot);
+    uncommitted_pages.insert(page);
+    dirty_start = std::min(dirty_start, page);
+    dirty_end = std::max(dirty_end, page + page_size);
+    return page;
+}
+
+// Replaced pages are handed to the manager with the root that no longer uses them
+// Pages taken since the last commit were never published, they are reused right away
+void BPlusTree::MarkPageAsObsolete(uint64_t pointer) {
+    if(uncommitted_pages.erase(pointer) > 0) {
+        manager->FreePage(pointer);
+        return;
+    }
+    obsolete_pages.push_back(pointer);
+}
+
+// Overflow pages are taken up front so the chain runs forward through the file
+vector<uint8_t> BPlusTree::StoreValue(span<const uint8_t> value) {
+    if(value.size() <= overflow_threshold) {
+        return InlineValue(value);
+    }
+    vector<uint64_t> pages;
+    uint64_t page_data = OverflowPageData(*manager);
+    for(uint64_t start = 0; start < value.size(); start += page_data) {
+        pages.push_back(manager->GetFreePage(root_slot));
+        uncommitted_pages.insert(pages.back());
+    }
+    for(size_t i = 0; i < pages.size(); i++) {
+        vector<uint8_t> data = ToCharVector<uint64_t>(i + 1 < pages.size() ? pages[i + 1] : 0);
+        auto start = value.begin() + i * page_data;
+        data.insert(data.end(), start, start + std::min<uint64_t>(page_data, value.end() - start));
+        manager->WritePage(pages[i], data);
+        dirty_start = std::min(dirty_start, pages[i]);
+        dirty_end = std::max(dirty_end, pages[i] + page_size);
+    }
+    return OverflowValue({pages[0], value.size()});
+}
+
+// Overflow pages of a value that was overwritten or deleted, retired like the leaf that held it
+void BPlusTree::FreeValue(span<const uint8_t> stored) {
+    if(!IsOverflowValue(stored)) {
+        return;
+    }
+    for(auto page : OverflowPages(*manager, ParseOverflowValue(stored))) {
+        MarkPageAsObsolete(page);
+    }
+}
+
+void BPlusTree::SetOverflowThreshold(uint64_t bytes) {
+    overflow_threshold = std::min<uint64_t>(bytes, page_size / 4);
+}
+
+// Make all written pages durable, then publish the root
+void BPlusTree::Commit() {
+    if(dirty_start < dirty_end) {
+        manager->Flush(dirty_start, dirty_end - dirty_start);
+    }
+    dirty_start = UINT64_MAX;
+    dirty_end = 0;
+    if(root_pointer != manager->GetRoot(root_slot)) {
+        manager->SetRoot(root_slot, root_pointer, obsolete_pages);
+        obsolete_pages.clear();
+    }
+    uncommitted_pages.clear();
+}
+
+void BPlusTree::BeginTransaction() {
+    in_transaction = true;
+}
+
+void BPlusTree::CommitTransaction() {
+    in_transaction = false;
+    Commit();
+}
+
+void BPlusTree::Write(const WriteBatch& batch) {
+    std::unique_lock<std::mutex> lock(commit_mutex);
+    PendingWrite pending{&batch, false};
+    commit_queue.push_back(&pending);
+    commit_cv.wait(lock, [&] { return pending.done || commit_queue.front() == &pending; });
+    if(pending.done) {
+        return;
+    }
+
+    // First in line, apply everything queued so far under one commit
+    vector<PendingWrite*> group(commit_queue.begin(), commit_queue.end());
+    lock.unlock();
+    // Runs of puts between deletes go down the tree together, see InsertBatch
+    vector<std::pair<vector<uint8_t>, vector<uint8_t>>> puts;
+    for(auto write : group) {
+        for(auto& op : write->batch->ops) {
+            if(op.type == WriteOpType::PUT) {
+                insert_counter.count.fetch_add(1, std::memory_order_relaxed);
+                puts.push_back({op.key, op.value});
+                continue;
+            }
+            if(!puts.empty()) {
+                ApplyInsertBatch(puts);
+                puts.clear();
+            }
+            delete_counter.count.fetch_add(1, std::memory_order_relaxed);
+            ApplyDelete(op.key);
+        }
+    }
+    if(!puts.empty()) {
+        ApplyInsertBatch(puts);
+    }
+    if(!in_transaction) {
+        Commit();
+    }
+    lock.lock();
+
+    for(auto write : group) {
+        write->done = true;
+        commit_queue.pop_front();
+    }
+    commit_cv.notify_all();
+}
+
+vector<uint8_t> BPlusTree::Get(span<const uint8_t> key) {
+    vector<uint8_t> value;
+    Get(key, value);
+    return value;
+}
+
+void BPlusTree::Get(span<const uint8_t> key, vector<uint8_t>& value) {
+    OperationTimer timer(get_counter, timing_sample);
+    NodeView leaf = FindLeaf(*manager, root_pointer, key);
+    auto stored = LeafValue(leaf, key);
+    if(IsOverflowValue(stored)) {
+        ResolveValue(*manager, stored, value);
+        return;
+    }
+    auto resolved = ResolveValue(*manager, stored, value);
+    value.assign(resolved.begin(), resolved.end());
+}
+
+span<const uint8_t> BPlusTree::GetView(span<const uint8_t> key) {
+    return ResolveValue(*manager, LookupValue(*manager, root_pointer, key), view_buffer);
+}
+
+bool BPlusTree::StreamValue(span<const uint8_t> key, std::function<void(span<const uint8_t>)> callback) {
+    NodeView leaf = FindLeaf(*manager, root_pointer, key);
+    uint16_t index = leaf.Find(key);
+    if(index == leaf.KeyCount()) {
+        return false;
+    }
+    ::StreamValue(*manager, leaf.Value(index), callback);
+    return true;
+}
+
+vector<std::optional<vector<uint8_t>>> BPlusTree::MultiGet(span<const vector<uint8_t>> keys, uint16_t threads, bool prefetch) {
+    get_counter.count.fetch_add(keys.size(), std::memory_order_relaxed);
+    return MultiLookup(*manager, root_pointer, keys, threads, prefetch);
+}
+
+Cursor BPlusTree::NewCursor() {
+    return Cursor(*manager, root_pointer);
+}
+
+void BPlusTree::Scan(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback) {
+    ScanRange(*manager, root_pointer, lo, hi, callback);
+}
+
+Snapshot BPlusTree::GetSnapshot() {
+    return Snapshot(*manager, root_slot);
+}
+
+std::shared_ptr<DiskManager> BPlusTree::GetDiskManager() {
+    return manager;
+}
+
+bool BPlusTree::InTransaction() {
+    return in_transaction;
+}
+
+void BPlusTree::Drop() {
+    CollectPages(root_pointer);
+    manager->SetRoot(root_slot, 0, obsolete_pages);
+    obsolete_pages.clear();
+    uncommitted_pages.clear();
+    root_pointer = 0;
+    dirty_start = UINT64_MAX;
+    dirty_end = 0;
+}
+
+void BPlusTree::CollectPages(uint64_t pointer) {
+    MarkPageAsObsolete(pointer);
+    NodeView node = manager->GetNodeView(pointer);
+    for(uint16_t i = 0; i < node.KeyCount(); i++) {
+        if(node.Type() == BNodeType::NODE) {
+            CollectPages(node.Pointer(i));
+        }
+        else {
+            FreeValue(node.Value(i));
+        }
+    }
+}
+
+CompactionStatus BPlusTree::Compact(uint64_t max_pages) {
+    if(in_transaction) {
+        std::cerr << "Can not compact during a transaction" << std::endl;
+        return COMPACTION_REFUSED;
+    }
+    uint64_t budget = max_pages == 0 ? UINT64_MAX : max_pages;
+    while(true) {
+        if(compaction_key.empty()) {
+            compaction_from = 0;
+        }
+        bool stopped = false;
+        root_pointer = CompactNode(root_pointer, budget, stopped);
+        Commit();
+        if(stopped) {
+            return COMPACTION_STOPPED;
+        }
+        compaction_key.clear();
+        // Pages the ordering moved away from are free from the commit on, unless a snapshot holds them
+        if(!compaction_packing) {
+            compaction_packing = true;
+            continue;
+        }
+        // Parents were placed after their children, and pages after ones moved in this pass, before the pages vacated were freed
+        // So the root and some others can end up behind free pages, settling moves those down into them
+        if(!compaction_settling) {
+            EngineStats stats = manager->GetStats();
+            compaction_settling = true;
+            compaction_live_end = (stats.file_pages - stats.free_pages) * page_size;
+            continue;
+        }
+        compaction_packing = false;
+        compaction_settling = false;
+        manager->TruncateFreeTail();
+        return COMPACTION_DONE;
+    }
 }
 
-vector<uint8_t> BPlusTree::Get(vector<uint8_t> key) {
-    auto node = manager.GetNode(root_pointer);
-    while(node.type != BNodeType::LEAF) {
-        for(auto key_val = node.pointer_map.rbegin(); key_val != node.pointer_map.rend(); key_val++) {
-            if(key_val->first <= key) {
-                node = manager.GetNode(key_val->second);
+// Children are moved before their parent, so the leaves under a node follow each other in key order
+// Children wholly before compaction_key are left alone, once the budget runs out so is the rest and compaction_key marks where
+// Returns the node's page, the old one unless it moved
+uint64_t BPlusTree::CompactNode(uint64_t pointer, uint64_t& budget, bool& stopped) {
+    BPlusNode node = *manager->GetNode(pointer);
+    bool changed = false;
+    if(node.type == BNodeType::NODE) {
+        for(auto child = node.pointer_map.begin(); child != node.pointer_map.end() && !stopped; child++) {
+            auto next = std::next(child);
+            if(!compaction_key.empty() && next != node.pointer_map.end() && next->first <= compaction_key) {
+                continue;
+            }
+            if(budget == 0) {
+                compaction_key = child->first;
+                stopped = true;
                 break;
             }
+            uint64_t page = CompactNode(child->second, budget, stopped);
+            changed |= page != child->second;
+            child->second = page;
         }
     }
-    return node.value_map[key];
+    else {
+        for(auto& key_value : node.value_map) {
+            vector<uint8_t> moved = CompactValue(key_value.second, budget);
+            if(!moved.empty()) {
+                key_value.second = std::move(moved);
+                changed = true;
+            }
+        }
+    }
+
+    uint64_t page = CompactionPage(pointer, changed);
+    if(page == 0) {
+        return pointer;
+    }
+    MarkPageAsObsolete(pointer);
+    manager->WriteNodeAt(page, std::move(node));
+    budget -= budget > 0;
+    return page;
+}
+
+// Overflow chains move whole so they stay in order, the stored value pointing at the new chain is returned, empty if it stays
+vector<uint8_t> BPlusTree::CompactValue(span<const uint8_t> stored, uint64_t& budget) {
+    if(!IsOverflowValue(stored)) {
+        return {};
+    }
+    OverflowReference reference = ParseOverflowValue(stored);
+    vector<uint64_t> old_pages = OverflowPages(*manager, reference);
+    uint64_t first = CompactionPage(*std::max_element(old_pages.begin(), old_pages.end()), false);
+    if(first == 0) {
+        return {};
+    }
+    vector<uint64_t> pages{first};
+    while(pages.size() < old_pages.size()) {
+        pages.push_back(CompactionPage(UINT64_MAX, true));
+    }
+    for(size_t i = 0; i < pages.size(); i++) {
+        PageHandle old_data = manager->GetPage(old_pages[i]);
+        vector<uint8_t> data = ToCharVector<uint64_t>(i + 1 < pages.size() ? pages[i + 1] : 0);
+        data.insert(data.end(), old_data.get() + sizeof(uint64_t), old_data.get() + page_size);
+        manager->WritePage(pages[i], data);
+        MarkPageAsObsolete(old_pages[i]);
+        budget -= budget > 0;
+    }
+    return OverflowValue({first, reference.length});
+}
+
+// Page the node or overflow chain ending at pointer moves to, 0 if it stays
+// Ordering moves what is behind the pages placed so far, packing moves what has a free page between them and it
+// Settling moves what is past compaction_live_end into the lowest free page below it, wherever that is
+uint64_t BPlusTree::CompactionPage(uint64_t pointer, bool rewrite) {
+    bool behind = pointer < compaction_from;
+    uint64_t from = compaction_settling ? 0 : compaction_from;
+    uint64_t page = 0;
+    if(compaction_settling ? pointer >= compaction_live_end : (compaction_packing && !behind)) {
+        page = manager->GetLowestFreePage(from, pointer);
+    }
+    if(page == 0 && (rewrite || (behind && !compaction_packing))) {
+        page = manager->GetLowestFreePage(from, UINT64_MAX);
+    }
+    if(page == 0) {
+        compaction_from = std::max(compaction_from, pointer + page_size);
+        return 0;
+    }
+    compaction_from = std::max(compaction_from, page + page_size);
+    uncommitted_pages.insert(page);
+    dirty_start = std::min(dirty_start, page);
+    dirty_end = std::max(dirty_end, page + page_size);
+    return page;
 }
 
-void BPlusTree::Delete(vector<uint8_t> key) {
-    root_pointer = manager.WriteNode(RecursiveDelete(manager.GetNode(root_pointer), key));
-    manager.SetRoot(root_pointer);
+void BPlusTree::Delete(span<const uint8_t> key) {
+    OperationTimer timer(delete_counter, timing_sample);
+    ApplyDelete(key);
+    if(!in_transaction) {
+        Commit();
+    }
+}
+
+// Root left with a single child is replaced by it, so the tree loses a level
+// Longer separators can also overfill the root, which then splits and the tree gains one
+void BPlusTree::ApplyDelete(span<const uint8_t> key) {
+    BPlusNode root = RecursiveDelete(manager->TakeNode(root_pointer), key);
+    MarkPageAsObsolete(root.node_pointer);
+    root.node_pointer = 0;
+    if(root.type == BNodeType::NODE && root.pointer_map.size() == 1) {
+        root_pointer = root.pointer_map.begin()->second;
+        NodeView child = manager->GetNodeView(root_pointer);
+        while(child.Type() == BNodeType::NODE && child.KeyCount() == 1) {
+            MarkPageAsObsolete(root_pointer);
+            root_pointer = child.Pointer(0);
+            child = manager->GetNodeView(root_pointer);
+        }
+        return;
+    }
+    if(root.value_map.empty() && root.pointer_map.empty()) {
+        root_pointer = WriteNode(BPlusNode(BNodeType::LEAF));
+        return;
+    }
+    root_pointer = GrowRoot(WriteSplitNode(std::move(root)));
 }
 
-BPlusNode BPlusTree::RecursiveDelete(BPlusNode node, vector<uint8_t> key) {
+// Returns the node without the key, not yet written, its old page is for the caller to retire
+// Children that fall under the merge threshold are merged with a sibling, or share its entries if both do not fit in one node
+// A child can also outgrow its page when a longer first key replaces a separator below it, so every child is split to fit
+BPlusNode BPlusTree::RecursiveDelete(BPlusNode node, span<const uint8_t> key) {
     if(node.type == BNodeType::LEAF) {
-        node = node.DeleteKV(key);
-        // manager.MarkPageAsObsolete(node.node_pointer);
-        node.node_pointer = manager.WriteNode(node);
+        auto old_value = node.value_map.find(key);
+        if(old_value != node.value_map.end()) {
+            FreeValue(old_value->second);
+            node.value_map.erase(old_value);
+        }
         return node;
     }
-    for(auto key_val = node.pointer_map.rbegin(); key_val != node.pointer_map.rend(); key_val++)
-    {
-        if(key_val->first <= key) {
-            auto new_node = RecursiveDelete(manager.GetNode(key_val->second), key);
-            if(key_val->first != key) {
-                node = node.UpdateKV(key_val->first, new_node.node_pointer);
-            }
-            else {
-                node = node.DeleteKV(key);
-                if(new_node.pointer_map.empty() && new_node.value_map.empty()) {
-                    // manager.MarkPageAsObsolete(node.node_pointer);
-                    node.node_pointer = manager.WriteNode(node);
-                    return node;
-                }
-                if(new_node.type == BNodeType::LEAF) {
-                    node = node.InsertKV(new_node.value_map.begin()->first, new_node.node_pointer);
-                }
-                else {
-                    node = node.InsertKV(new_node.pointer_map.begin()->first, new_node.node_pointer);
+    auto key_val = node.FindChild(key);
+    if(key_val == node.pointer_map.end()) {
+        ThrowEmptyNode(node);
+    }
+    vector<uint8_t> child_key = key_val->first;
+    BPlusNode new_node = RecursiveDelete(manager->TakeNode(key_val->second), key);
+    MarkPageAsObsolete(new_node.node_pointer);
+    vector<BPlusNode> children;
+    // Separator of the leftmost child, kept unless it was the deleted key
+    vector<uint8_t> first_key = child_key;
+
+    if(IsUnderfull(new_node) && node.pointer_map.size() > 1) {
+        auto sibling = std::next(key_val);
+        bool right = sibling != node.pointer_map.end();
+        if(!right) {
+            sibling = std::prev(key_val);
+            first_key = sibling->first;
+        }
+        BPlusNode sibling_node = manager->TakeNode(sibling->second);
+        MarkPageAsObsolete(sibling->second);
+        node.pointer_map.erase(sibling);
+        children = SplitNode(right ? MergeNodes(std::move(new_node), std::move(sibling_node)) : MergeNodes(std::move(sibling_node), std::move(new_node)));
+        (children.size() == 1 ? node_merges : node_borrows).fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        children = SplitNode(std::move(new_node));
+        node_splits.fetch_add(children.size() - 1, std::memory_order_relaxed);
+    }
+    node.DeleteKV(child_key);
+
+    for(size_t i = 0; i < children.size(); i++) {
+        if(children[i].value_map.empty() && children[i].pointer_map.empty()) {
+            continue;
+        }
+        vector<uint8_t> separator = FirstKey(children[i]);
+        if(i == 0 && !std::ranges::equal(first_key, key)) {
+            separator = first_key;
+        }
+        node.InsertKV(std::move(separator), WriteNode(std::move(children[i])));
+    }
+    return node;
+}
+
+// Below merge_threshold of a page, inner nodes also of the branching factor since either can fill them
+// Inner nodes with one child always are
+bool BPlusTree::IsUnderfull(BPlusNode& node) {
+    if(node.type == BNodeType::NODE) {
+        return node.pointer_map.size() < 2 || (
+            node.pointer_map.size() < branching_factor * merge_threshold &&
+            node.GetBytes() < page_size * merge_threshold);
+    }
+    return node.value_map.empty() || node.GetBytes() < page_size * merge_threshold;
+}
+
+// Entries of two adjacent nodes of one type in a single node, SplitNode divides it again if it does not fit
+BPlusNode BPlusTree::MergeNodes(BPlusNode left, BPlusNode right) {
+    left.value_map.merge(right.value_map);
+    left.pointer_map.merge(right.pointer_map);
+    left.node_pointer = 0;
+    return left;
+}
+
+// Only a corrupt tree has an inner node without children, there is no child to descend into
+void BPlusTree::ThrowEmptyNode(const BPlusNode& node) {
+    std::cerr << "Inner node at " << node.node_pointer << " has no children" << std::endl;
+    throw std::runtime_error("Corrupt tree");
+}
+
+vector<uint8_t> BPlusTree::FirstKey(BPlusNode& node) {
+    if(node.type == BNodeType::LEAF) {
+        return node.value_map.begin()->first;
+    }
+    return node.pointer_map.begin()->first;
+}
+
+void BPlusTree::SetMergeThreshold(double threshold) {
+    merge_threshold = threshold;
+}
+
+BPlusTree::BulkLoadState BPlusTree::StartBulkLoad(double fill_factor) {
+    BulkLoadState state{{}, 0, {}, {}, BPlusNode(BNodeType::LEAF), 0, 0, 0, 0, fill_factor, {}, {}};
+    state.fill_bytes = page_size * fill_factor;
+    CollectEntries(root_pointer, state);
+    return state;
+}
+
+// Existing entries in key order, merged with the loaded ones
+void BPlusTree::CollectEntries(uint64_t pointer, BulkLoadState& state) {
+    state.old_pages.push_back(pointer);
+    NodeView node = manager->GetNodeView(pointer);
+    for(uint16_t i = 0; i < node.KeyCount(); i++) {
+        if(node.Type() == BNodeType::LEAF) {
+            auto value = node.Value(i);
+            state.existing.push_back({node.Key(i), vector<uint8_t>(value.begin(), value.end())});
+        }
+        else {
+            CollectEntries(node.Pointer(i), state);
+        }
+    }
+}
+
+// Serialized size of a node with a shared key prefix, see BPlusNode::GetBytes
+uint64_t BPlusTree::PackedNodeBytes(uint64_t count, uint64_t key_bytes, uint64_t value_bytes, uint64_t prefix_length) {
+    return 5 + prefix_length + (count + 1) * 4 + key_bytes - count * prefix_length + value_bytes;
+}
+
+void BPlusTree::BulkLoadAdd(BulkLoadState& state, const vector<uint8_t>& key, const vector<uint8_t>& value) {
+    if(!state.last_key.empty() && CompareKeys(key, state.last_key) <= 0) {
+        state.late.push_back({key, value});
+        return;
+    }
+    while(state.existing_index < state.existing.size() && state.existing[state.existing_index].first < key) {
+        BulkLoadAppend(state, state.existing[state.existing_index].first, state.existing[state.existing_index].second);
+        state.existing_index++;
+    }
+    if(state.existing_index < state.existing.size() && state.existing[state.existing_index].first == key) {
+        FreeValue(state.existing[state.existing_index].second);
+        state.existing_index++; // replaced by the loaded value
+    }
+    BulkLoadAppend(state, key, StoreValue(value));
+    state.last_key = key;
+}
+
+void BPlusTree::BulkLoadAppend(BulkLoadState& state, const vector<uint8_t>& key, const vector<uint8_t>& value) {
+    uint64_t count = state.leaf.value_map.size();
+    if(count > 0) {
+        uint64_t prefix = std::min<uint64_t>(state.leaf_prefix, CommonPrefixLength(state.leaf.value_map.begin()->first, key));
+        uint64_t bytes = PackedNodeBytes(count + 1, state.leaf_key_bytes + key.size(), state.leaf_value_bytes + value.size(), prefix);
+        if(bytes <= state.fill_bytes) {
+            state.leaf.InsertKV(key, value);
+            state.leaf_key_bytes += key.size();
+            state.leaf_value_bytes += value.size();
+            state.leaf_prefix = prefix;
+            return;
+        }
+        vector<uint8_t> first_key = state.leaf.value_map.begin()->first;
+        state.level.push_back({first_key, WriteNode(std::move(state.leaf))});
+        state.leaf = BPlusNode(BNodeType::LEAF);
+    }
+    state.leaf.InsertKV(key, value);
+    state.leaf_key_bytes = key.size();
+    state.leaf_value_bytes = value.size();
+    state.leaf_prefix = key.size();
+}
+
+void BPlusTree::FinishBulkLoad(BulkLoadState& state) {
+    for(; state.existing_index < state.existing.size(); state.existing_index++) {
+        BulkLoadAppend(state, state.existing[state.existing_index].first, state.existing[state.existing_index].second);
+    }
+    if(!state.leaf.value_map.empty()) {
+        vector<uint8_t> first_key = state.leaf.value_map.begin()->first;
+        state.level.push_back({first_key, WriteNode(std::move(state.leaf))});
+    }
+    // Nothing loaded into an empty tree, its empty root leaf stays
+    if(state.level.empty()) {
+        return;
+    }
+
+    // Internal levels, bounded by the branching factor as well as the page
+    uint64_t max_children = std::max<uint64_t>(2, (branching_factor - 1) * state.fill_factor);
+    while(state.level.size() > 1) {
+        vector<std::pair<vector<uint8_t>, uint64_t>> parents;
+        BPlusNode node(BNodeType::NODE);
+        uint64_t key_bytes = 0, prefix = 0;
+        for(auto& child : state.level) {
+            uint64_t count = node.pointer_map.size();
+            if(count > 0) {
+                uint64_t child_prefix = std::min<uint64_t>(prefix, CommonPrefixLength(node.pointer_map.begin()->first, child.first));
+                uint64_t bytes = PackedNodeBytes(count + 1, key_bytes + child.first.size(), (count + 1) * 16, child_prefix);
+                if(count < max_children && bytes <= state.fill_bytes) {
+                    node.InsertKV(child.first, child.second);
+                    key_bytes += child.first.size();
+                    prefix = child_prefix;
+                    continue;
                 }
+                vector<uint8_t> first_key = node.pointer_map.begin()->first;
+                parents.push_back({first_key, WriteNode(std::move(node))});
+                node = BPlusNode(BNodeType::NODE);
             }
-            // manager.MarkPageAsObsolete(node.node_pointer);
-            node.node_pointer = manager.WriteNode(node);
-            return node;
+            node.InsertKV(child.first, child.second);
+            key_bytes = child.first.size();
+            prefix = child.first.size();
         }
+        vector<uint8_t> first_key = node.pointer_map.begin()->first;
+        parents.push_back({first_key, WriteNode(std::move(node))});
+        state.level = std::move(parents);
+    }
+
+    for(auto page : state.old_pages) {
+        MarkPageAsObsolete(page);
+    }
+    root_pointer = state.level[0].second;
+    Commit();
+
+    for(auto& key_value : state.late) {
+        ApplyInsert(key_value.first, key_value.second);
     }
-    std::cerr << "Shits fucked in RecursiveDelete" << std::endl; // TODO
-    return {nullptr};
+    Commit();
 }
 
 vector<BPlusNode> BPlusTree::SplitNode(BPlusNode node) {
-    if(node.GetBytes() <= 4096 && branching_factor > node.pointer_map.size()) {
-        return {node};
+    vector<BPlusNode> nodes;
+    if((node.GetBytes() <= page_size && branching_factor > node.pointer_map.size()) || node.value_map.size() + node.pointer_map.size() < 2) {
+        nodes.push_back(std::move(node));
+        return nodes;
     }
-    
-    BPlusNode first(node.type), second(node.type);
-    int first_size, second_size;
 
+    // Upper half of the entries is moved over to a second node, keys and values are not copied
+    BPlusNode second(node.type);
     if(node.type == BNodeType::LEAF) {
-        int i = 0;
-        for(auto key_val : node.value_map) {
-            if(i < node.value_map.size() / 2) {
-                first = first.InsertKV(key_val.first, key_val.second);
-            }
-            else {
-                second = second.InsertKV(key_val.first, key_val.second);
-            }
-            i++;
+        auto middle = std::next(node.value_map.begin(), node.value_map.size() / 2);
+        while(middle != node.value_map.end()) {
+            second.value_map.insert(second.value_map.end(), node.value_map.extract(middle++));
         }
     }
     else {
-        int i = 0;
-        for(auto key_val : node.pointer_map) {
-            if(i < node.pointer_map.size() / 2) {
-                first = first.InsertKV(key_val.first, key_val.second);
-            }
-            else {
-                second = second.InsertKV(key_val.first, key_val.second);
-            }
-            i++;
+        auto middle = std::next(node.pointer_map.begin(), node.pointer_map.size() / 2);
+        while(middle != node.pointer_map.end()) {
+            second.pointer_map.insert(second.pointer_map.end(), node.pointer_map.extract(middle++));
         }
     }
+    node.node_pointer = 0;
+
+    // Halves of a node holding large values or a whole batch of keys may still not fit
+    nodes = SplitNode(std::move(node));
+    for(auto& part : SplitNode(std::move(second))) {
+        nodes.push_back(std::move(part));
+    }
+    return nodes;
+}
 
-    return  {first, second};
+void BPlusTree::Insert(span<const uint8_t> key, span<const uint8_t> value) {
+    OperationTimer timer(insert_counter, timing_sample);
+    ApplyInsert(key, value);
+    if(!in_transaction) {
+        Commit();
+    }
+}
 
+void BPlusTree::Update(span<const uint8_t> key, span<const uint8_t> value) {
+    Insert(key, value);
 }
 
-void BPlusTree::Insert(vector<uint8_t> key, vector<uint8_t> value) {
-    auto new_children = RecursiveInsert(manager.GetNode(root_pointer), key, value);
-    if(new_children.size() == 1) {
-        root_pointer = new_children[0].node_pointer;
+void BPlusTree::InsertBatch(vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries) {
+    insert_counter.count.fetch_add(entries.size(), std::memory_order_relaxed);
+    ApplyInsertBatch(entries);
+    if(!in_transaction) {
+        Commit();
     }
-    else {
+}
+
+// Sorted with the last value of each key kept, then applied in one descent from the root
+void BPlusTree::ApplyInsertBatch(vector<std::pair<vector<uint8_t>, vector<uint8_t>>>& entries) {
+    std::stable_sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    vector<std::pair<vector<uint8_t>, vector<uint8_t>>> unique;
+    unique.reserve(entries.size());
+    for(auto& entry : entries) {
+        if(!unique.empty() && unique.back().first == entry.first) {
+            unique.back().second = std::move(entry.second);
+        }
+        else {
+            unique.push_back(std::move(entry));
+        }
+    }
+    if(unique.empty()) {
+        return;
+    }
+    for(auto& entry : unique) {
+        entry.second = StoreValue(entry.second);
+    }
+    root_pointer = GrowRoot(RecursiveInsertBatch(manager->TakeNode(root_pointer), unique));
+}
+
+// A root split into more children than fit in one node grows the tree by as many levels as needed
+uint64_t BPlusTree::GrowRoot(vector<std::pair<vector<uint8_t>, uint64_t>> children) {
+    while(children.size() > 1) {
         BPlusNode new_root(BNodeType::NODE);
-        vector<uint8_t> key;
-        for(auto nc : new_children) {
-            if(nc.type == BNodeType::LEAF) {
-                key = nc.value_map.begin()->first;
+        for(auto& child : children) {
+            new_root.InsertKV(std::move(child.first), child.second);
+        }
+        children = WriteSplitNode(std::move(new_root));
+    }
+    return children[0].second;
+}
+
+// Replaces the node's page with as many pages as it needs, returns the first key and page of each
+vector<std::pair<vector<uint8_t>, uint64_t>> BPlusTree::WriteSplitNode(BPlusNode node) {
+    if(node.node_pointer != 0) {
+        MarkPageAsObsolete(node.node_pointer);
+    }
+    auto parts = SplitNode(std::move(node));
+    node_splits.fetch_add(parts.size() - 1, std::memory_order_relaxed);
+    vector<std::pair<vector<uint8_t>, uint64_t>> children;
+    children.reserve(parts.size());
+    for(auto& part : parts) {
+        vector<uint8_t> first_key = FirstKey(part);
+        children.push_back({std::move(first_key), WriteNode(std::move(part))});
+    }
+    return children;
+}
+
+// Entries are sorted and unique, each child gets the run of entries below the next child's key
+vector<std::pair<vector<uint8_t>, uint64_t>> BPlusTree::RecursiveInsertBatch(BPlusNode node, span<std::pair<vector<uint8_t>, vector<uint8_t>>> entries) {
+    if(node.type == BNodeType::LEAF) {
+        for(auto& entry : entries) {
+            auto old_value = node.value_map.find(entry.first);
+            if(old_value != node.value_map.end()) {
+                FreeValue(old_value->second);
+                old_value->second = std::move(entry.second);
             }
             else {
-                key = nc.pointer_map.begin()->first;
+                node.InsertKV(std::move(entry.first), std::move(entry.second));
+            }
+        }
+    }
+    else {
+        size_t start = 0;
+        if(node.pointer_map.empty()) {
+            ThrowEmptyNode(node);
+        }
+        while(start < entries.size()) {
+            auto child = node.FindChild(entries[start].first);
+            auto next = std::next(child);
+            size_t end = start + 1;
+            while(end < entries.size() && (next == node.pointer_map.end() || entries[end].first < next->first)) {
+                end++;
             }
-            new_root = new_root.InsertKV(key, nc.node_pointer);
+            auto children = RecursiveInsertBatch(manager->TakeNode(child->second), entries.subspan(start, end - start));
+            child->second = children[0].second;
+            for(size_t j = 1; j < children.size(); j++) {
+                node.InsertKV(std::move(children[j].first), children[j].second);
+            }
+            start = end;
         }
-        root_pointer = manager.WriteNode(new_root);
     }
-    manager.SetRoot(root_pointer);
+    return WriteSplitNode(std::move(node));
 }
 
-vector<BPlusNode> BPlusTree::RecursiveInsert(BPlusNode node, vector<uint8_t> key, vector<uint8_t> value) {
+void BPlusTree::ApplyInsert(span<const uint8_t> key, span<const uint8_t> value) {
+    vector<uint8_t> stored = StoreValue(value);
+    root_pointer = GrowRoot(RecursiveInsert(manager->TakeNode(root_pointer), key, stored));
+}
+
+// The node is consumed, the key is only copied where it is added to a leaf
+vector<std::pair<vector<uint8_t>, uint64_t>> BPlusTree::RecursiveInsert(BPlusNode node, span<const uint8_t> key, vector<uint8_t>& value) {
     if(node.type == BNodeType::LEAF) {
-        if(node.value_map.size() == 0) {
-            node = node.InsertKV(key, value);
-            // manager.MarkPageAsObsolete(node.node_pointer);
-            node.node_pointer = manager.WriteNode(node);
-            return {node};
-        }
-        if(node.HasKey(key)) {
-            node = node.UpdateKV(key, value);
+        auto old_value = node.value_map.find(key);
+        if(old_value != node.value_map.end()) {
+            FreeValue(old_value->second);
+            old_value->second = std::move(value);
         }
         else {
-            node = node.InsertKV(key, value);
-        }
-        auto new_nodes = SplitNode(node);
-        // manager.MarkPageAsObsolete(node.node_pointer);
-        for(auto& n : new_nodes) {
-            n.node_pointer = manager.WriteNode(n);
-        }
-        return new_nodes;
-    }
-    for(auto key_val = node.pointer_map.rbegin(); key_val != node.pointer_map.rend(); key_val++)
-    {
-        if(key_val->first <= key) {
-            auto new_nodes = RecursiveInsert(manager.GetNode(key_val->second), key, value);
-            node = node.UpdateKV(key_val->first, new_nodes[0].node_pointer);
-            for(int j = 1; j < new_nodes.size(); j++) {
-                if(new_nodes[j].type == BNodeType::LEAF) {
-                    node = node.InsertKV(new_nodes[j].value_map.begin()->first, new_nodes[j].node_pointer);
-                }
-                else {
-                    node = node.InsertKV(new_nodes[j].pointer_map.begin()->first, new_nodes[j].node_pointer);
-                }
-            }
-            auto split_nodes = SplitNode(node);
-            // manager.MarkPageAsObsolete(node.node_pointer);
-            for(auto& n : split_nodes) {
-                n.node_pointer = manager.WriteNode(n);
-            }
-            return split_nodes;
+            node.InsertKV(vector<uint8_t>(key.begin(), key.end()), std::move(value));
         }
+        return WriteSplitNode(std::move(node));
+    }
+    auto key_val = node.FindChild(key);
+    if(key_val == node.pointer_map.end()) {
+        ThrowEmptyNode(node);
+    }
+    auto children = RecursiveInsert(manager->TakeNode(key_val->second), key, value);
+    key_val->second = children[0].second;
+    for(size_t j = 1; j < children.size(); j++) {
+        node.InsertKV(std::move(children[j].first), children[j].second);
+    }
+    return WriteSplitNode(std::move(node));
+}
+
+uint64_t BPlusTree::VerifyFreeSpace(bool repair) {
+    if(in_transaction || root_pointer != manager->GetRoot(root_slot)) {
+        std::cerr << "Free space can only be verified between commits" << std::endl;
+        return 0;
     }
-    std::cerr << "Shits fucked in RecursiveInsert" << std::endl; // TODO
-    return {nullptr};
+    return manager->VerifyFreeSpace(repair);
+}
+
+CacheStats BPlusTree::GetCacheStats() {
+    return manager->GetCacheStats();
+}
+
+EngineStats BPlusTree::Stats() {
+    EngineStats stats = manager->GetStats();
+    stats.node_splits = node_splits.load(std::memory_order_relaxed);
+    stats.node_merges = node_merges.load(std::memory_order_relaxed);
+    stats.node_borrows = node_borrows.load(std::memory_order_relaxed);
+    stats.insert = insert_counter.Read();
+    stats.get = get_counter.Read();
+    stats.remove = delete_counter.Read();
+    return stats;
+}
+
+void BPlusTree::SetTimingSample(uint32_t sample_every) {
+    timing_sample = sample_every;
 }
 
 void BPlusTree::PrintTree() {
-    PrintTreeRecursive(manager.GetNode(root_pointer));
+    PrintTreeRecursive(*manager->GetNode(root_pointer));
 }
 
-void BPlusTree::PrintTreeRecursive(BPlusNode node) {
+void BPlusTree::PrintTreeRecursive(const BPlusNode& node) {
     if(node.type == BNodeType::LEAF) {
         node.PrintNodeData();
         return;
     }
     node.PrintNodeData();
     for(auto p : node.pointer_map) {
-        PrintTreeRecursive(manager.GetNode(p.second));
+        PrintTreeRecursive(*manager->GetNode(p.second));
     }
 }
\ No newline at end of file
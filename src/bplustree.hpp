@@ -1,45 +1,223 @@
 #ifndef BPLUSTREE
 #define BPLUSTREE
 
+#include <atomic>
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <vector>
 #include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <functional>
+#include <unordered_set>
 
 using std::vector;
 using std::map;
 
 #include "bplusnode.hpp"
 #include "diskmanager.hpp"
+#include "nodeview.hpp"
+#include "cursor.hpp"
+#include "overflow.hpp"
+#include "snapshot.hpp"
+
+#define DEFAULT_FILL_FACTOR 0.9
+#define DEFAULT_MERGE_THRESHOLD 0.25
+#define DEFAULT_COMPACTION_STEP_PAGES 256
+
+enum WriteOpType : uint8_t {
+    PUT,
+    DELETE
+};
+
+enum CompactionStatus : uint8_t {
+    COMPACTION_DONE,
+    COMPACTION_STOPPED, // Budget ran out, call again to continue
+    COMPACTION_REFUSED // Nothing done, the tree is in a transaction
+};
+
+struct WriteOp {
+    WriteOpType type;
+    vector<uint8_t> key;
+    vector<uint8_t> value;
+};
+
+// Group of writes applied and made durable together by BPlusTree::Write
+class WriteBatch {
+    public:
+        void Put(vector<uint8_t> key, vector<uint8_t> value);
+        void Delete(vector<uint8_t> key);
+
+        vector<WriteOp> ops;
+};
 
 // Handles Insert, Updata, Delete operations
 class BPlusTree {
     public:
-        BPlusTree(std::string filename, uint64_t branching_factor);
+        BPlusTree(std::string filename, uint64_t branching_factor, uint64_t cache_bytes = DEFAULT_CACHE_BYTES, PageIOOptions io_options = PageIOOptions());
+        // Another tree in the same file with its root in root_slot, its writer can run on its own thread
+        BPlusTree(std::shared_ptr<DiskManager> manager, uint16_t root_slot, uint64_t branching_factor);
 
-        void Insert(vector<uint8_t> key, vector<uint8_t> value);
-        void Update(vector<uint8_t> key, vector<uint8_t> value);
-        void Delete(vector<uint8_t> key);
+        void Insert(span<const uint8_t> key, span<const uint8_t> value);
+        // Inserts or updates every pair in one pass from the root, each node on the way is written once and the root published once
+        // Pairs may be in any order, the last value of a repeated key wins
+        void InsertBatch(vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries);
+        void Update(span<const uint8_t> key, span<const uint8_t> value);
+        void Delete(span<const uint8_t> key);
+        // Fraction of a page below which a node left by a delete is merged with or borrows from a sibling, 0 only removes empty nodes
+        void SetMergeThreshold(double threshold);
+        // Values longer than this are written to overflow pages and referenced from the leaf, capped at a quarter page
+        void SetOverflowThreshold(uint64_t bytes);
+
+        // Writes between Begin and Commit are flushed with a single sync and published as one root
+        void BeginTransaction();
+        void CommitTransaction();
+        // Thread safe, concurrent batches are merged into one flush by whichever writer is first in line
+        void Write(const WriteBatch& batch);
+
+        // Builds the tree bottom-up from key sorted (key, value) pairs and commits with a single flush
+        // Existing entries are merged in, entries out of order are inserted normally afterwards
+        template<typename Iterator> void BulkLoad(Iterator begin, Iterator end, double fill_factor = DEFAULT_FILL_FACTOR);
 
         void PrintTree();
+        CacheStats GetCacheStats();
+        // Counters of this tree and of the file it is in
+        EngineStats Stats();
+        // Times one in every sample_every calls of Insert, Get and Delete, 0 only counts them and is the default
+        void SetTimingSample(uint32_t sample_every);
+        std::shared_ptr<DiskManager> GetDiskManager();
+        bool InTransaction();
+        // Frees every page of the tree and clears its root slot, the tree can not be used afterwards
+        void Drop();
+        // Pages marked in use but unreachable from any root, see DiskManager::VerifyFreeSpace
+        uint64_t VerifyFreeSpace(bool repair = false);
+        // Lays the tree's pages out in key order from the start of the file, then truncates the free pages left at its end
+        // A pass first moves pages that are out of order past the ones before them, then moves every page down into the lowest free page ahead of it
+        // Pages still past the size the file would have without free pages are moved down at the end, into the ones the packing freed
+        // max_pages ends a step after about that many pages moved and publishes the root, the next call picks up where it stopped
+        // 0 runs the pass whole, pages a snapshot still reads are only freed once it is gone
+        CompactionStatus Compact(uint64_t max_pages = 0);
+
+        vector<uint8_t> Get(span<const uint8_t> key);
+        // Value copied into value reusing its capacity, empty if key is missing
+        void Get(span<const uint8_t> key, vector<uint8_t>& value);
+        // Value in place in the mapped page, valid until the next write, empty if key is missing
+        // Overflow values are read into a buffer instead, valid until the next GetView
+        span<const uint8_t> GetView(span<const uint8_t> key);
+        // Passes the value to callback a page at a time, false if key is missing
+        bool StreamValue(span<const uint8_t> key, std::function<void(span<const uint8_t>)> callback);
+        // Values in the order of keys, nullopt for missing keys, see MultiLookup
+        vector<std::optional<vector<uint8_t>>> MultiGet(span<const vector<uint8_t>> keys, uint16_t threads = 1, bool prefetch = true);
 
-        vector<uint8_t> Get(vector<uint8_t> key);
+        // Cursor over the current root, valid until the next write
+        Cursor NewCursor();
+        // Streams entries with lo <= key < hi in key order until callback returns false, empty hi is unbounded
+        void Scan(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback);
+
+        // Pins the last committed root for readers on other threads, the tree's own reads are for the writer only
+        Snapshot GetSnapshot();
 
     private:
-        vector<BPlusNode> RecursiveInsert(BPlusNode node, vector<uint8_t> key, vector<uint8_t> value);
-        BPlusNode RecursiveDelete(BPlusNode node, vector<uint8_t> key);
-        void PrintTreeRecursive(BPlusNode node);
-        BPlusNode LeafSearch(vector<uint8_t> key, BPlusNode node);
+        struct BulkLoadState {
+            vector<std::pair<vector<uint8_t>, vector<uint8_t>>> existing;
+            size_t existing_index;
+            vector<uint64_t> old_pages;
+            vector<std::pair<vector<uint8_t>, vector<uint8_t>>> late;
+
+            BPlusNode leaf;
+            uint64_t leaf_key_bytes;
+            uint64_t leaf_value_bytes;
+            uint64_t leaf_prefix;
+            uint64_t fill_bytes;
+            double fill_factor;
+            vector<uint8_t> last_key;
+            vector<std::pair<vector<uint8_t>, uint64_t>> level;
+        };
+        BulkLoadState StartBulkLoad(double fill_factor);
+        void BulkLoadAdd(BulkLoadState& state, const vector<uint8_t>& key, const vector<uint8_t>& value);
+        void BulkLoadAppend(BulkLoadState& state, const vector<uint8_t>& key, const vector<uint8_t>& value);
+        void FinishBulkLoad(BulkLoadState& state);
+        void CollectEntries(uint64_t pointer, BulkLoadState& state);
+        static uint64_t PackedNodeBytes(uint64_t count, uint64_t key_bytes, uint64_t value_bytes, uint64_t prefix_length);
+
+        void ApplyInsert(span<const uint8_t> key, span<const uint8_t> value);
+        void ApplyInsertBatch(vector<std::pair<vector<uint8_t>, vector<uint8_t>>>& entries);
+        void ApplyDelete(span<const uint8_t> key);
+        void Commit();
+        uint64_t WriteNode(BPlusNode node);
+        void MarkPageAsObsolete(uint64_t pointer);
+        vector<uint8_t> StoreValue(span<const uint8_t> value);
+        void FreeValue(span<const uint8_t> stored);
+        void CollectPages(uint64_t pointer);
+        uint64_t CompactNode(uint64_t pointer, uint64_t& budget, bool& stopped);
+        vector<uint8_t> CompactValue(span<const uint8_t> stored, uint64_t& budget);
+        uint64_t CompactionPage(uint64_t pointer, bool rewrite);
+
+        // Nodes are passed down by value and moved, what goes back up is the first key and page of each written node
+        vector<std::pair<vector<uint8_t>, uint64_t>> RecursiveInsert(BPlusNode node, span<const uint8_t> key, vector<uint8_t>& value);
+        vector<std::pair<vector<uint8_t>, uint64_t>> RecursiveInsertBatch(BPlusNode node, span<std::pair<vector<uint8_t>, vector<uint8_t>>> entries);
+        BPlusNode RecursiveDelete(BPlusNode node, span<const uint8_t> key);
+        vector<std::pair<vector<uint8_t>, uint64_t>> WriteSplitNode(BPlusNode node);
+        uint64_t GrowRoot(vector<std::pair<vector<uint8_t>, uint64_t>> children);
+        void PrintTreeRecursive(const BPlusNode& node);
 
         vector<BPlusNode> SplitNode(BPlusNode node);
-        BPlusNode MergeNodes(std::vector<BPlusNode> nodes);
+        BPlusNode MergeNodes(BPlusNode left, BPlusNode right);
+        bool IsUnderfull(BPlusNode& node);
+        static vector<uint8_t> FirstKey(BPlusNode& node);
+        [[noreturn]] static void ThrowEmptyNode(const BPlusNode& node);
 
         std::string filename;
-        DiskManager manager;
+        std::shared_ptr<DiskManager> manager;
+        uint16_t root_slot;
         uint64_t root_pointer;
         uint64_t file_page_count;
 
+        uint64_t page_size;
         uint64_t branching_factor;
+        double merge_threshold;
+        uint64_t overflow_threshold;
+        vector<uint8_t> view_buffer;
+
+        uint32_t timing_sample;
+        OperationCounter insert_counter;
+        OperationCounter get_counter;
+        OperationCounter delete_counter;
+        std::atomic<uint64_t> node_splits;
+        std::atomic<uint64_t> node_merges;
+        std::atomic<uint64_t> node_borrows;
+
+        bool in_transaction;
+        uint64_t dirty_start;
+        uint64_t dirty_end;
+        vector<uint64_t> obsolete_pages;
+        // Taken since the last commit, no published root or snapshot can reach them
+        std::unordered_set<uint64_t> uncommitted_pages;
+
+        vector<uint8_t> compaction_key; // subtrees before it were done by earlier steps
+        uint64_t compaction_from; // page after the last one placed in key order
+        bool compaction_packing; // second half of the pass
+        bool compaction_settling; // end of the pass, only pages past compaction_live_end move
+        uint64_t compaction_live_end; // pages from here on sit behind free ones, the file would end here without them
+
+        struct PendingWrite {
+            const WriteBatch* batch;
+            bool done;
+        };
+        std::mutex commit_mutex;
+        std::condition_variable commit_cv;
+        std::deque<PendingWrite*> commit_queue;
 };
 
+template<typename Iterator> void BPlusTree::BulkLoad(Iterator begin, Iterator end, double fill_factor) {
+    BulkLoadState state = StartBulkLoad(fill_factor);
+    for(auto it = begin; it != end; it++) {
+        BulkLoadAdd(state, it->first, it->second);
+    }
+    FinishBulkLoad(state);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include "cursor.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+
+Cursor::Cursor(DiskManager& manager, uint64_t root, uint16_t readahead_pages) : manager(manager) {
+    this->root = root;
+    this->readahead_pages = readahead_pages;
+}
+
+void Cursor::Push(uint64_t pointer, bool from_left) {
+    NodeView node = manager.GetNodeView(pointer);
+    uint16_t index = (from_left || node.KeyCount() == 0) ? 0 : node.KeyCount() - 1;
+    path.push_back({node, index, index, index});
+}
+
+// Follow the current child of each level down to a leaf, at its first or last key
+void Cursor::Descend(bool from_left) {
+    while(path.back().node.Type() != BNodeType::LEAF && path.back().node.KeyCount() > 0) {
+        Frame& frame = path.back();
+        Advise(frame, from_left);
+        Push(frame.node.Pointer(frame.index), from_left);
+    }
+}
+
+// Ask the kernel to read the next children in scan direction before the cursor gets there
+void Cursor::Advise(Frame& frame, bool forward) {
+    if(readahead_pages == 0) {
+        return;
+    }
+    int32_t count = frame.node.KeyCount();
+    if(forward && frame.index >= frame.advised_until) {
+        int32_t last = std::min(count - 1, frame.index + readahead_pages);
+        for(int32_t i = frame.index + 1; i <= last; i++) {
+            manager.Prefetch(frame.node.Pointer(i));
+        }
+        frame.advised_until = frame.index + readahead_pages;
+    }
+    if(!forward && frame.index <= frame.advised_from) {
+        int32_t first = std::max(0, frame.index - readahead_pages);
+        for(int32_t i = first; i < frame.index; i++) {
+            manager.Prefetch(frame.node.Pointer(i));
+        }
+        frame.advised_from = frame.index - readahead_pages;
+    }
+}
+
+// Moves to the neighbouring leaf while the current position is past either end of its leaf
+void Cursor::Settle(bool forward) {
+    while(!path.empty() && path.back().index >= path.back().node.KeyCount()) {
+        path.pop_back();
+        while(!path.empty()) {
+            Frame& frame = path.back();
+            if(forward && frame.index + 1 < frame.node.KeyCount()) {
+                frame.index++;
+                Descend(true);
+                break;
+            }
+            if(!forward && frame.index > 0) {
+                frame.index--;
+                Descend(false);
+                break;
+            }
+            path.pop_back();
+        }
+    }
+}
+
+void Cursor::Seek(span<const uint8_t> key) {
+    path.clear();
+    Push(root, true);
+    while(path.back().node.Type() != BNodeType::LEAF && path.back().node.KeyCount() > 0) {
+        Frame& frame = path.back();
+        frame.index = frame.node.FindChild(key);
+        frame.advised_from = frame.index;
+        frame.advised_until = frame.index;
+        Advise(frame, true);
+        Push(frame.node.Pointer(frame.index), true);
+    }
+    path.back().index = path.back().node.LowerBound(key);
+    Settle(true);
+}
+
+void Cursor::SeekToFirst() {
+    path.clear();
+    Push(root, true);
+    Descend(true);
+    Settle(true);
+}
+
+void Cursor::SeekToLast() {
+    path.clear();
+    Push(root, false);
+    Descend(false);
+    Settle(false);
+}
+
+bool Cursor::Valid() {
+    return !path.empty() && path.back().index < path.back().node.KeyCount();
+}
+
+void Cursor::Next() {
+    if(!Valid()) {
+        return;
+    }
+    path.back().index++;
+    Settle(true);
+}
+
+void Cursor::Prev() {
+    if(!Valid()) {
+        return;
+    }
+    Frame& leaf = path.back();
+    if(leaf.index > 0) {
+        leaf.index--;
+        return;
+    }
+    leaf.index = leaf.node.KeyCount(); // past the end, step to the previous leaf
+    Settle(false);
+}
+
+span<const uint8_t> Cursor::Key() {
+    Frame& leaf = path.back();
+    auto prefix = leaf.node.Prefix();
+    auto suffix = leaf.node.KeySuffix(leaf.index);
+    key_buffer.assign(prefix.begin(), prefix.end());
+    key_buffer.insert(key_buffer.end(), suffix.begin(), suffix.end());
+    return key_buffer;
+}
+
+// Overflow values are read into a buffer, also valid until the cursor moves
+span<const uint8_t> Cursor::Value() {
+    return ResolveValue(manager, path.back().node.Value(path.back().index), value_buffer);
+}
+
+NodeView FindLeaf(DiskManager& manager, uint64_t root, span<const uint8_t> key) {
+    NodeView node = manager.GetNodeView(root);
+    while(node.Type() != BNodeType::LEAF) {
+        node = manager.GetNodeView(node.Pointer(node.FindChild(key)));
+    }
+    return node;
+}
+
+span<const uint8_t> LeafValue(const NodeView& leaf, span<const uint8_t> key) {
+    uint16_t index = leaf.Find(key);
+    if(index == leaf.KeyCount()) {
+        return {};
+    }
+    return leaf.Value(index);
+}
+
+span<const uint8_t> LookupValue(DiskManager& manager, uint64_t root, span<const uint8_t> key) {
+    return LeafValue(FindLeaf(manager, root, key), key);
+}
+
+// order holds indexes of keys in key order, all of them under pointer
+static void MultiLookupFrom(DiskManager& manager, uint64_t pointer, span<const vector<uint8_t>> keys, span<const uint32_t> order, bool prefetch, vector<std::optional<vector<uint8_t>>>& values) {
+    NodeView node = manager.GetNodeView(pointer);
+    if(node.Type() == BNodeType::LEAF) {
+        vector<uint8_t> buffer;
+        for(auto i : order) {
+            uint16_t index = node.Find(keys[i]);
+            if(index < node.KeyCount()) {
+                auto value = ResolveValue(manager, node.Value(index), buffer);
+                values[i].emplace(value.begin(), value.end());
+            }
+        }
+        return;
+    }
+    if(node.KeyCount() == 0) {
+        return;
+    }
+    // Runs of keys bound for the same child, as (child, end of the run in order)
+    vector<std::pair<uint16_t, size_t>> runs;
+    for(size_t j = 0; j < order.size(); j++) {
+        uint16_t child = node.FindChild(keys[order[j]]);
+        if(!runs.empty() && runs.back().first == child) {
+            runs.back().second = j + 1;
+        }
+        else {
+            runs.push_back({child, j + 1});
+        }
+    }
+    // Every child on the way is requested before the first one is read, pages close together in one request
+    if(prefetch && runs.size() > 1) {
+        vector<uint64_t> pages;
+        for(auto& run : runs) {
+            pages.push_back(node.Pointer(run.first));
+        }
+        std::sort(pages.begin(), pages.end());
+        uint64_t first = pages[0];
+        for(size_t j = 1; j <= pages.size(); j++) {
+            if(j == pages.size() || pages[j] - pages[j - 1] > DEFAULT_READAHEAD_PAGES * manager.PageSize()) {
+                manager.Prefetch(first, (pages[j - 1] - first) / manager.PageSize() + 1);
+                if(j < pages.size()) {
+                    first = pages[j];
+                }
+            }
+        }
+    }
+    size_t start = 0;
+    for(auto& run : runs) {
+        MultiLookupFrom(manager, node.Pointer(run.first), keys, order.subspan(start, run.second - start), prefetch, values);
+        start = run.second;
+    }
+}
+
+vector<std::optional<vector<uint8_t>>> MultiLookup(DiskManager& manager, uint64_t root, span<const vector<uint8_t>> keys, uint16_t threads, bool prefetch) {
+    vector<uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    vector<std::optional<vector<uint8_t>>> values(keys.size());
+
+    size_t parts = std::clamp<size_t>(keys.size() / MULTI_LOOKUP_MIN_KEYS_PER_THREAD, 1, std::max<uint16_t>(threads, 1));
+    auto run = [&](size_t part) {
+        size_t begin = part * order.size() / parts;
+        size_t end = (part + 1) * order.size() / parts;
+        MultiLookupFrom(manager, root, keys, span<const uint32_t>(order).subspan(begin, end - begin), prefetch, values);
+    };
+    vector<std::thread> workers;
+    for(size_t part = 1; part < parts; part++) {
+        workers.emplace_back(run, part);
+    }
+    run(0);
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    return values;
+}
+
+static bool ScanLeavesFrom(DiskManager& manager, uint64_t pointer, span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(const NodeView&, uint16_t, uint16_t)>& callback) {
+    NodeView node = manager.GetNodeView(pointer);
+    if(node.Type() == BNodeType::LEAF) {
+        uint16_t begin = node.LowerBound(lo);
+        uint16_t end = hi.empty() ? node.KeyCount() : node.LowerBound(hi);
+        return begin >= end || callback(node, begin, end);
+    }
+    if(node.KeyCount() == 0) {
+        return true;
+    }
+    uint16_t first = node.FindChild(lo);
+    uint16_t last = hi.empty() ? node.KeyCount() - 1 : node.FindChild(hi);
+    // Keeps the next DEFAULT_READAHEAD_PAGES children in range on their way in
+    for(uint32_t i = first + 1; i <= std::min<uint32_t>(last, first + DEFAULT_READAHEAD_PAGES); i++) {
+        manager.Prefetch(node.Pointer(i));
+    }
+    for(uint32_t i = first; i <= last; i++) {
+        if(i > first && i + DEFAULT_READAHEAD_PAGES <= last) {
+            manager.Prefetch(node.Pointer(i + DEFAULT_READAHEAD_PAGES));
+        }
+        if(!ScanLeavesFrom(manager, node.Pointer(i), lo, hi, callback)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ScanLeaves(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(const NodeView&, uint16_t, uint16_t)> callback) {
+    ScanLeavesFrom(manager, root, lo, hi, callback);
+}
+
+// Goes down a level at a time until there are enough subtrees in range, then deals them out evenly
+vector<vector<uint8_t>> SplitKeyRange(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, uint16_t parts) {
+    // (first key, pointer) of the subtrees in range at the current level, the first key of the first one may sort before lo
+    vector<std::pair<vector<uint8_t>, uint64_t>> level = {{{}, root}};
+    while(level.size() < parts) {
+        vector<std::pair<vector<uint8_t>, uint64_t>> next;
+        for(auto& subtree : level) {
+            NodeView node = manager.GetNodeView(subtree.second);
+            if(node.Type() != BNodeType::NODE || node.KeyCount() == 0) {
+                next.clear();
+                break;
+            }
+            uint16_t first = node.FindChild(lo);
+            uint16_t last = hi.empty() ? node.KeyCount() - 1 : node.FindChild(hi);
+            for(uint32_t i = first; i <= last; i++) {
+                next.push_back({node.Key(i), node.Pointer(i)});
+            }
+        }
+        if(next.empty()) {
+            break;
+        }
+        level = std::move(next);
+    }
+    vector<vector<uint8_t>> keys;
+    uint32_t count = std::min<uint32_t>(parts, level.size());
+    for(uint32_t part = 1; part < count; part++) {
+        keys.push_back(level[part * level.size() / count].first);
+    }
+    return keys;
+}
+
+void ScanRange(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback) {
+    Cursor cursor(manager, root);
+    for(cursor.Seek(lo); cursor.Valid(); cursor.Next()) {
+        auto key = cursor.Key();
+        if(!hi.empty() && CompareKeys(key, hi) >= 0) {
+            return;
+        }
+        if(!callback(key, cursor.Value())) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef CURSOR
+#define CURSOR
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+#include "diskmanager.hpp"
+#include "nodeview.hpp"
+#include "overflow.hpp"
+
+using std::span;
+using std::vector;
+
+#define DEFAULT_READAHEAD_PAGES 8
+// MultiLookup only splits keys between threads while each gets at least this many
+#define MULTI_LOOKUP_MIN_KEYS_PER_THREAD 64
+
+// Ordered iteration over the tree under a fixed root
+// Keeps the root-to-leaf path on a stack instead of sibling links, which copy-on-write could not keep up to date
+// Reads pages in place, so a cursor is only valid until the next write to the tree
+class Cursor {
+    public:
+        Cursor(DiskManager& manager, uint64_t root, uint16_t readahead_pages = DEFAULT_READAHEAD_PAGES);
+
+        // Position at the first key >= key
+        void Seek(span<const uint8_t> key);
+        void SeekToFirst();
+        void SeekToLast();
+
+        bool Valid();
+        void Next();
+        void Prev();
+
+        // Assembled from the leaf's shared prefix and the key suffix, valid until the cursor moves
+        span<const uint8_t> Key();
+        span<const uint8_t> Value();
+
+    private:
+        struct Frame {
+            NodeView node;
+            uint16_t index;
+            int32_t advised_from; // children prefetched so far in either direction
+            int32_t advised_until;
+        };
+
+        void Push(uint64_t pointer, bool from_left);
+        void Descend(bool from_left);
+        void Settle(bool forward);
+        void Advise(Frame& frame, bool forward);
+
+        DiskManager& manager;
+        uint64_t root;
+        uint16_t readahead_pages;
+        vector<Frame> path;
+        vector<uint8_t> key_buffer;
+        vector<uint8_t> value_buffer;
+};
+
+// Leaf of the tree under root that key belongs in
+NodeView FindLeaf(DiskManager& manager, uint64_t root, span<const uint8_t> key);
+// Value of key as stored in place in the leaf, empty if key is missing, see ResolveValue
+span<const uint8_t> LeafValue(const NodeView& leaf, span<const uint8_t> key);
+// Value of key as stored in place in the tree under root, valid until the next write, empty if key is missing
+span<const uint8_t> LookupValue(DiskManager& manager, uint64_t root, span<const uint8_t> key);
+// Values of keys in the tree under root in the order given, nullopt for missing keys
+// Keys are looked up in sorted order so neighbours share the nodes above them, threads > 1 splits them into sorted runs
+// With prefetch the children each node leads to are hinted before the first is read, which pays off when pages
+// come from disk but costs a system call per run of pages when they are already cached
+vector<std::optional<vector<uint8_t>>> MultiLookup(DiskManager& manager, uint64_t root, span<const vector<uint8_t>> keys, uint16_t threads, bool prefetch);
+// Entries with lo <= key < hi in key order until callback returns false, empty hi is unbounded
+void ScanRange(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback);
+// Leaves holding keys with lo <= key < hi in key order, with the index range of those keys, until callback returns false
+// Values are as stored, see ResolveValue
+void ScanLeaves(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(const NodeView&, uint16_t, uint16_t)> callback);
+// Up to parts - 1 ascending keys dividing lo <= key < hi between disjoint subtrees
+// Taken from the highest level with at least parts subtrees in range, or from the leaves' parents
+vector<vector<uint8_t>> SplitKeyRange(DiskManager& manager, uint64_t root, span<const uint8_t> lo, span<const uint8_t> hi, uint16_t parts);
+
+#endif
@@ -4,101 +4,758 @@
 #include <cstdint>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <ostream>
 #include <string>
 #include <sys/types.h>
+#include <thread>
 #include <vector>
 #include "bitutils.hpp"
 
-DB::DB(std::string filename) : 
-    storage(filename, 4),
+DB::DB(std::string filename, bool tree_per_table, PageIOOptions io_options) : 
+    storage(filename, 4, DEFAULT_CACHE_BYTES, io_options),
     meta_table("@meta", 1, {DataType::STRING, DataType::STRING}, {"key", "val"}),
     table_schema_table("@table", 2, {DataType::STRING, DataType::STRING}, {"name", "def"}) {
 
-    storage.Insert({'@', 'm', 'e', 't', 'a'}, meta_table.SerializeTableSchema());
-    storage.Insert({'@', 't', 'a', 'b', 'l', 'e'}, table_schema_table.SerializeTableSchema());
+    this->tree_per_table = tree_per_table;
+    timing_sample = 0;
+    table_locks[0] = std::make_unique<std::recursive_mutex>();
+
+    vector<uint8_t> meta_key = {'@', 'm', 'e', 't', 'a'};
+    vector<uint8_t> table_key = {'@', 't', 'a', 'b', 'l', 'e'};
+    if(storage.Get(meta_key).empty()) { // new database
+        storage.BeginTransaction();
+        storage.Insert(meta_key, meta_table.SerializeTableSchema());
+        storage.Insert(table_key, table_schema_table.SerializeTableSchema());
+        storage.CommitTransaction();
+    }
+    LoadCatalog();
+}
+
+void DB::LoadCatalog() {
+    tables.clear();
+    tables_by_prefix.clear();
+    vector<uint8_t> lo({'\002'}), hi({'\003'});
+    storage.Scan(lo, hi, [&](span<const uint8_t>, span<const uint8_t> value) {
+        Table table(value);
+        auto inserted = tables.insert_or_assign(table.name, table);
+        tables_by_prefix[table.prefix] = &inserted.first->second;
+        return true;
+    });
+    index_prefixes.clear();
+    vector<uint8_t> index_lo({'\003'}), index_hi({'\004'});
+    storage.Scan(index_lo, index_hi, [&](span<const uint8_t>, span<const uint8_t> value) {
+        Index index(value);
+        auto table = tables.find(index.table_name);
+        if(table != tables.end()) {
+            table->second.indexes.push_back(index);
+            index_prefixes.insert(index.prefix);
+        }
+        return true;
+    });
+    for(auto& table : tables) {
+        if(table.second.root_slot != 0) {
+            OpenTableTree(table.second.root_slot);
+        }
+    }
+}
+
+void DB::OpenTableTree(uint16_t root_slot) {
+    table_trees[root_slot] = std::make_unique<BPlusTree>(storage.GetDiskManager(), root_slot, 4);
+    table_trees[root_slot]->SetTimingSample(timing_sample);
+    table_locks[root_slot] = std::make_unique<std::recursive_mutex>();
+}
+
+// Lowest slot not used by any table, 0 if all are taken
+uint16_t DB::FreeRootSlot() {
+    for(uint16_t slot = 1; slot < ROOT_SLOTS; slot++) {
+        if(table_trees.count(slot) == 0) {
+            return slot;
+        }
+    }
+    return 0;
+}
+
+BPlusTree& DB::TableTree(Table& table) {
+    if(table.root_slot == 0) {
+        return storage;
+    }
+    return *table_trees.at(table.root_slot);
+}
+
+std::recursive_mutex& DB::TableLock(Table& table) {
+    return *table_locks.at(table.root_slot);
+}
+
+vector<uint8_t> DB::CatalogKey(std::string table_name) {
+    vector<uint8_t> key({'\002'}); // Prefix
+    std::copy(table_name.begin(), table_name.end(), std::back_inserter(key));
+    return key;
+}
+
+// Table name then column, the name is ended by a 0 byte so one table's entries are not mixed with another's
+vector<uint8_t> DB::IndexCatalogKey(std::string table_name, uint16_t column) {
+    vector<uint8_t> key({'\003'}); // Prefix
+    std::copy(table_name.begin(), table_name.end(), std::back_inserter(key));
+    key.push_back(0);
+    for(auto c : ToCharVector(column)) {
+        key.push_back(c);
+    }
+    return key;
 }
 
 void DB::CreateTable(Table table) {
-    Table table_schema_table(storage.Get({'@', 't', 'a', 'b', 'l', 'e'}).data());
-    vector<uint8_t> table_def = table.SerializeTableSchema();
-    vector<uint8_t> table_name({'\002'}); // Prefix
-    for(auto c : table.name) {
-        table_name.push_back(c);
+    if(IsReservedPrefix(table.prefix)) {
+        std::cerr << "Prefix " << table.prefix << " overlaps the catalog keys" << std::endl;
+        return;
+    }
+    if(index_prefixes.count(table.prefix) > 0) {
+        std::cerr << "Prefix " << table.prefix << " is used by an index" << std::endl;
+        return;
+    }
+    auto same_prefix = tables_by_prefix.find(table.prefix);
+    if(same_prefix != tables_by_prefix.end() && same_prefix->second->name != table.name) {
+        std::cerr << "Table " << same_prefix->second->name << " already uses prefix " << table.prefix << std::endl;
+        return;
+    }
+    auto existing = tables.find(table.name);
+    if(existing != tables.end()) {
+        tables_by_prefix.erase(existing->second.prefix);
+        table.root_slot = existing->second.root_slot;
+        table.indexes = existing->second.indexes;
+    }
+    else if(tree_per_table) {
+        table.root_slot = FreeRootSlot();
+        if(table.root_slot == 0) {
+            std::cerr << "No root slot left for table " << table.name << ", using the shared tree" << std::endl;
+        }
     }
-    storage.Insert(table_name, table_def);
+
+    // Catalog first, a slot without a root gets an empty tree when opened
+    storage.Insert(CatalogKey(table.name), table.SerializeTableSchema());
+    if(table.root_slot != 0 && table_trees.count(table.root_slot) == 0) {
+        OpenTableTree(table.root_slot);
+    }
+    auto inserted = tables.insert_or_assign(table.name, table);
+    tables_by_prefix[table.prefix] = &inserted.first->second;
+}
+
+void DB::DropTable(std::string table_name) {
+    TableHandle table = OpenTable(table_name);
+    if(table.table == nullptr) {
+        return;
+    }
+
+    uint16_t root_slot = table.table->root_slot;
+    for(auto& index : table.table->indexes) {
+        index_prefixes.erase(index.prefix);
+    }
+    if(root_slot != 0) {
+        storage.BeginTransaction();
+        for(auto& index : table.table->indexes) {
+            storage.Delete(IndexCatalogKey(table_name, index.column));
+        }
+        storage.Delete(CatalogKey(table_name));
+        storage.CommitTransaction();
+        table_trees.at(root_slot)->Drop();
+        table_trees.erase(root_slot);
+        table_locks.erase(root_slot);
+        tables_by_prefix.erase(table.table->prefix);
+        tables.erase(table_name);
+        return;
+    }
+
+    vector<vector<uint8_t>> keys;
+    vector<uint8_t> lo(ToCharVector(table.table->prefix));
+    vector<uint8_t> hi = PrefixEnd(table.table->prefix);
+    storage.Scan(lo, hi, [&](span<const uint8_t> key, span<const uint8_t>) {
+        keys.push_back(vector<uint8_t>(key.begin(), key.end()));
+        return true;
+    });
+    for(auto& index : table.table->indexes) {
+        auto index_keys = IndexKeys(*table.table, index);
+        keys.insert(keys.end(), index_keys.begin(), index_keys.end());
+        keys.push_back(IndexCatalogKey(table_name, index.column));
+    }
+
+    storage.BeginTransaction();
+    for(auto& key : keys) {
+        storage.Delete(key);
+    }
+    storage.Delete(CatalogKey(table_name));
+    storage.CommitTransaction();
+
+    tables_by_prefix.erase(table.table->prefix);
+    tables.erase(table_name);
+}
+
+TableHandle DB::OpenTable(std::string table_name) {
+    auto table = tables.find(table_name);
+    if(table == tables.end()) {
+        std::cerr << "No table named " << table_name << std::endl;
+        return {nullptr};
+    }
+    return {&table->second};
 }
 
-/*
-    Schema : | n_records | rec_1 | \0 | rec_2 | ... | \0 |
-*/
 void DB::InsertRow(std::string table_name, uint32_t primary_key, vector<std::any> values) {
-    vector<uint8_t> prefixed_table_name({'\002'});
-    for(auto c : table_name) {
-        prefixed_table_name.push_back(c);
+    InsertRow(OpenTable(table_name), primary_key, values);
+}
+
+void DB::InsertRow(TableHandle table, uint32_t primary_key, vector<std::any> values) {
+    if(table.table == nullptr) {
+        return;
+    }
+    if(!table.table->CheckSchema(values)) {
+        std::cerr << "Bad schema insert to table " << table.table->name << std::endl;
+        return;
     }
-    Table table(storage.Get(prefixed_table_name).data());
-    
-    if(!table.CheckSchema(values)) {
-        std::cerr << "Bad schema insert to table " << table_name << std::endl;
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    BPlusTree& tree = TableTree(*table.table);
+    vector<uint8_t> key = PrefixedKey(*table.table, primary_key);
+    vector<uint8_t> row = EncodeRow(*table.table, values);
+    if(table.table->indexes.empty()) {
+        tree.Insert(key, row);
         return;
     }
 
-    vector<uint8_t> serialized_row{(uint8_t)values.size()};
+    // Row and index entries in one commit, entries of the row it replaces are removed
+    auto old_entries = IndexEntries(*table.table, tree.Get(key), primary_key);
+    auto new_entries = IndexEntries(*table.table, row, primary_key);
+    WriteBatch batch;
+    for(size_t i = 0; i < old_entries.size(); i++) {
+        if(!old_entries[i].empty() && old_entries[i] != new_entries[i]) {
+            batch.Delete(old_entries[i]);
+        }
+    }
+    batch.Put(key, row);
+    for(auto& entry : new_entries) {
+        batch.Put(entry, {});
+    }
+    tree.Write(batch);
+}
 
-    for(int i = 0; i < values.size(); i++) {
-        vector<uint8_t> serialized_record = Record(table.schema[i], values[i]).Serialize();
-        serialized_row.insert(serialized_row.end(), serialized_record.begin(), serialized_record.end());
-        serialized_row.push_back('\0');
+void DB::InsertRows(std::string table_name, vector<std::pair<uint32_t, vector<std::any>>> rows) {
+    TableHandle table = OpenTable(table_name);
+    if(table.table == nullptr) {
+        return;
     }
 
-    vector<uint8_t> prefixed_key(ToCharVector(table.prefix));
-    for(auto c : ToCharVector(primary_key)) {
-        prefixed_key.push_back(c);
+    // Last row of a repeated primary key wins, as if inserted one by one
+    std::map<uint32_t, vector<uint8_t>> encoded;
+    for(auto& row : rows) {
+        if(!table.table->CheckSchema(row.second)) {
+            std::cerr << "Bad schema insert to table " << table_name << std::endl;
+            continue;
+        }
+        encoded[row.first] = EncodeRow(*table.table, row.second);
+    }
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    BPlusTree& tree = TableTree(*table.table);
+    if(table.table->indexes.empty()) {
+        vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries;
+        entries.reserve(encoded.size());
+        for(auto& row : encoded) {
+            entries.push_back({PrefixedKey(*table.table, row.first), std::move(row.second)});
+        }
+        tree.InsertBatch(std::move(entries));
+        return;
+    }
+
+    // Entries of replaced rows are deleted first, so the puts stay one run for InsertBatch
+    WriteBatch batch;
+    vector<WriteOp> puts;
+    for(auto& row : encoded) {
+        vector<uint8_t> key = PrefixedKey(*table.table, row.first);
+        auto old_entries = IndexEntries(*table.table, tree.Get(key), row.first);
+        auto new_entries = IndexEntries(*table.table, row.second, row.first);
+        for(size_t i = 0; i < old_entries.size(); i++) {
+            if(!old_entries[i].empty() && old_entries[i] != new_entries[i]) {
+                batch.Delete(old_entries[i]);
+            }
+        }
+        puts.push_back({WriteOpType::PUT, key, std::move(row.second)});
+        for(auto& entry : new_entries) {
+            puts.push_back({WriteOpType::PUT, entry, {}});
+        }
+    }
+    batch.ops.insert(batch.ops.end(), puts.begin(), puts.end());
+    tree.Write(batch);
+}
+
+void DB::BulkInsertRows(std::string table_name, vector<std::pair<uint32_t, vector<std::any>>> rows) {
+    TableHandle table = OpenTable(table_name);
+    if(table.table == nullptr) {
+        return;
+    }
+
+    vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries;
+    entries.reserve(rows.size());
+    for(auto& row : rows) {
+        if(!table.table->CheckSchema(row.second)) {
+            std::cerr << "Bad schema insert to table " << table_name << std::endl;
+            continue;
+        }
+        entries.push_back({PrefixedKey(*table.table, row.first), EncodeRow(*table.table, row.second)});
+    }
+    // Of rows with the same key only the last is loaded, as InsertRows does, so there is one set of index entries per key
+    std::stable_sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    vector<std::pair<vector<uint8_t>, vector<uint8_t>>> unique;
+    unique.reserve(entries.size());
+    for(auto& entry : entries) {
+        if(!unique.empty() && unique.back().first == entry.first) {
+            unique.back().second = std::move(entry.second);
+        }
+        else {
+            unique.push_back(std::move(entry));
+        }
+    }
+    entries = std::move(unique);
+
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    BPlusTree& tree = TableTree(*table.table);
+    if(table.table->indexes.empty()) {
+        tree.BulkLoad(entries.begin(), entries.end());
+        return;
     }
 
-    storage.Insert(prefixed_key, serialized_row);
+    // Index entries are loaded with the rows, entries of replaced rows are deleted afterwards
+    WriteBatch stale;
+    size_t n_rows = entries.size();
+    for(size_t i = 0; i < n_rows; i++) {
+        uint32_t primary_key = FromCharPointer<uint32_t>(entries[i].first.data() + sizeof(uint32_t));
+        auto old_entries = IndexEntries(*table.table, tree.Get(entries[i].first), primary_key);
+        auto new_entries = IndexEntries(*table.table, entries[i].second, primary_key);
+        for(size_t j = 0; j < new_entries.size(); j++) {
+            if(!old_entries[j].empty() && old_entries[j] != new_entries[j]) {
+                stale.Delete(old_entries[j]);
+            }
+            entries.push_back({new_entries[j], {}});
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    tree.BulkLoad(entries.begin(), entries.end());
+    if(!stale.ops.empty()) {
+        tree.Write(stale);
+    }
 }
 
 void DB::DeleteRow(std::string table_name, uint32_t primary_key) {
-    storage.Delete(GetPrefixedKey(table_name, primary_key));
+    DeleteRow(OpenTable(table_name), primary_key);
+}
+
+void DB::DeleteRow(TableHandle table, uint32_t primary_key) {
+    if(table.table == nullptr) {
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    BPlusTree& tree = TableTree(*table.table);
+    vector<uint8_t> key = PrefixedKey(*table.table, primary_key);
+    if(table.table->indexes.empty()) {
+        tree.Delete(key);
+        return;
+    }
+
+    WriteBatch batch;
+    batch.Delete(key);
+    for(auto& entry : IndexEntries(*table.table, tree.Get(key), primary_key)) {
+        if(!entry.empty()) {
+            batch.Delete(entry);
+        }
+    }
+    tree.Write(batch);
 }
 
 vector<std::any> DB::GetRow(std::string table_name, uint32_t primary_key) {
-    vector<uint8_t> serialized = storage.Get(GetPrefixedKey(table_name, primary_key));
-    uint8_t n_values = serialized[0];
-    vector<std::any> deserialized;
-    uint32_t current_value_pointer = 1;
-
-    for(int i = 0; i < n_values; i++) {
-        Record val(serialized.data() + current_value_pointer);
-        switch (val.type) {
-            case INTEGER:
-            {
-                current_value_pointer += sizeof(uint64_t) + 2;
-            }
-            break;
-            case STRING:
-            {
-                current_value_pointer += std::any_cast<std::string>(val.value).size() + 2;
+    return GetRow(OpenTable(table_name), primary_key);
+}
+
+vector<std::any> DB::GetRow(TableHandle table, uint32_t primary_key) {
+    if(table.table == nullptr) {
+        return {};
+    }
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    auto row = TableTree(*table.table).Get(PrefixedKey(*table.table, primary_key));
+    return RowView(table.table, row).ToValues();
+}
+
+vector<std::optional<vector<std::any>>> DB::GetRows(std::string table_name, span<const uint32_t> primary_keys, uint16_t threads, bool prefetch) {
+    return GetRows(OpenTable(table_name), primary_keys, threads, prefetch);
+}
+
+vector<std::optional<vector<std::any>>> DB::GetRows(TableHandle table, span<const uint32_t> primary_keys, uint16_t threads, bool prefetch) {
+    vector<std::optional<vector<std::any>>> rows(primary_keys.size());
+    if(table.table == nullptr) {
+        return rows;
+    }
+    vector<vector<uint8_t>> keys;
+    keys.reserve(primary_keys.size());
+    for(auto primary_key : primary_keys) {
+        keys.push_back(PrefixedKey(*table.table, primary_key));
+    }
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    auto values = TableTree(*table.table).MultiGet(keys, threads, prefetch);
+    for(size_t i = 0; i < values.size(); i++) {
+        if(values[i].has_value()) {
+            rows[i] = RowView(table.table, *values[i]).ToValues();
+        }
+    }
+    return rows;
+}
+
+RowView DB::GetRowView(TableHandle table, uint32_t primary_key) {
+    if(table.table == nullptr) {
+        return RowView(nullptr, {});
+    }
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    return RowView(table.table, TableTree(*table.table).GetView(PrefixedKey(*table.table, primary_key)));
+}
+
+void DB::ScanRows(std::string table_name, uint32_t lo, uint32_t hi, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    ScanKeyRange(OpenTable(table_name), ToCharVector(lo), ToCharVector(hi), callback);
+}
+
+void DB::ScanRows(std::string table_name, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    // Key one past the last primary key, longer than any of them
+    ScanKeyRange(OpenTable(table_name), ToCharVector((uint32_t)0), {0xff, 0xff, 0xff, 0xff, 0xff}, callback);
+}
+
+void DB::ScanKeyRange(TableHandle table, vector<uint8_t> lo_suffix, vector<uint8_t> hi_suffix, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    if(table.table == nullptr) {
+        return;
+    }
+    vector<uint8_t> lo(ToCharVector(table.table->prefix));
+    lo.insert(lo.end(), lo_suffix.begin(), lo_suffix.end());
+    vector<uint8_t> hi(ToCharVector(table.table->prefix));
+    hi.insert(hi.end(), hi_suffix.begin(), hi_suffix.end());
+
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    TableTree(*table.table).Scan(lo, hi, [&](span<const uint8_t> key, span<const uint8_t> value) {
+        return callback(FromCharPointer<uint32_t>(key.data() + sizeof(uint32_t)), RowView(table.table, value).ToValues());
+    });
+}
+
+AggregateResult DB::Aggregate(std::string table_name, std::string column_name, vector<IntegerPredicate> predicates, uint32_t lo, uint32_t hi, uint16_t threads) {
+    return AggregateKeyRange(OpenTable(table_name), column_name, predicates, ToCharVector(lo), ToCharVector(hi), threads);
+}
+
+AggregateResult DB::Aggregate(std::string table_name, std::string column_name, vector<IntegerPredicate> predicates, uint16_t threads) {
+    return AggregateKeyRange(OpenTable(table_name), column_name, predicates, ToCharVector((uint32_t)0), {0xff, 0xff, 0xff, 0xff, 0xff}, threads);
+}
+
+bool DB::IsIntegerColumn(Table& table, std::string column_name) {
+    auto column = std::find(table.column_names.begin(), table.column_names.end(), column_name);
+    if(column == table.column_names.end()) {
+        std::cerr << "No column " << column_name << " in table " << table.name << std::endl;
+        return false;
+    }
+    if(table.schema[column - table.column_names.begin()] != DataType::INTEGER) {
+        std::cerr << "Column " << column_name << " of table " << table.name << " is not INTEGER" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Each part of the range is scanned on its own thread with its own batch, the calling thread takes the first
+AggregateResult DB::AggregateKeyRange(TableHandle table, std::string column_name, vector<IntegerPredicate> predicates, vector<uint8_t> lo_suffix, vector<uint8_t> hi_suffix, uint16_t threads) {
+    if(table.table == nullptr || !IsIntegerColumn(*table.table, column_name)) {
+        return {};
+    }
+    for(auto& predicate : predicates) {
+        if(!IsIntegerColumn(*table.table, predicate.column)) {
+            return {};
+        }
+    }
+    vector<uint8_t> lo(ToCharVector(table.table->prefix));
+    lo.insert(lo.end(), lo_suffix.begin(), lo_suffix.end());
+    vector<uint8_t> hi(ToCharVector(table.table->prefix));
+    hi.insert(hi.end(), hi_suffix.begin(), hi_suffix.end());
+
+    Snapshot snapshot = TableTree(*table.table).GetSnapshot();
+    vector<vector<uint8_t>> bounds = snapshot.SplitKeyRange(lo, hi, threads);
+    bounds.insert(bounds.begin(), lo);
+    bounds.push_back(hi);
+
+    vector<AggregateResult> results(bounds.size() - 1);
+    auto run = [&](size_t part) {
+        AggregateBatch batch(*table.table, column_name, predicates);
+        vector<uint8_t> buffer;
+        snapshot.ScanLeaves(bounds[part], bounds[part + 1], [&](const NodeView& leaf, uint16_t begin, uint16_t end) {
+            for(uint16_t i = begin; i < end; i++) {
+                batch.Add(ResolveValue(snapshot.Manager(), leaf.Value(i), buffer));
             }
-            break;
+            return true;
+        });
+        results[part] = batch.Finish();
+    };
+    vector<std::thread> workers;
+    for(size_t part = 1; part < results.size(); part++) {
+        workers.emplace_back(run, part);
+    }
+    run(0);
+    AggregateResult result;
+    for(size_t part = 0; part < results.size(); part++) {
+        if(part > 0) {
+            workers[part - 1].join();
+        }
+        result.Merge(results[part]);
+    }
+    return result;
+}
 
-            default:
-                current_value_pointer += 2;
-            break;
+// Lowest prefix no table or index uses, 0 if there is none left
+// UINT32_MAX is never handed out, so one past any prefix is a prefix again
+uint32_t DB::FreeIndexPrefix() {
+    uint32_t prefix = 1;
+    while(prefix < UINT32_MAX) {
+        if(IsReservedPrefix(prefix)) {
+            prefix = ((prefix >> 24) + 1) << 24;
+            continue;
+        }
+        if(tables_by_prefix.count(prefix) == 0 && index_prefixes.count(prefix) == 0) {
+            return prefix;
         }
-        deserialized.push_back(val.value);
+        prefix++;
     }
-    return  deserialized;
+    return 0;
 }
 
-vector<uint8_t> DB::GetPrefixedKey(std::string table_name, uint32_t primary_key) {
-    vector<uint8_t> prefixed_table_name({'\002'});
-    std::copy(table_name.begin(), table_name.end(), std::back_inserter(prefixed_table_name));
+// Keys starting with these bytes are the catalog entries and @meta and @table, loaded by LoadCatalog
+bool DB::IsReservedPrefix(uint32_t prefix) {
+    uint8_t first = prefix >> 24;
+    return first == '\002' || first == '\003' || first == '@';
+}
+
+// Upper bound of a scan over every key with the prefix, empty and so unbounded past the last prefix
+vector<uint8_t> DB::PrefixEnd(uint32_t prefix) {
+    if(prefix == UINT32_MAX) {
+        return {};
+    }
+    return ToCharVector(prefix + 1);
+}
 
-    Table table(storage.Get(prefixed_table_name).data());
+Index* DB::FindIndex(TableHandle table, std::string column_name) {
+    if(table.table == nullptr) {
+        return nullptr;
+    }
+    for(auto& index : table.table->indexes) {
+        if(table.table->column_names[index.column] == column_name) {
+            return &index;
+        }
+    }
+    std::cerr << "No index on " << table.table->name << "." << column_name << std::endl;
+    return nullptr;
+}
+
+// Entry of the row in each of the table's indexes, all empty if there is no row
+vector<vector<uint8_t>> DB::IndexEntries(Table& table, span<const uint8_t> row, uint32_t primary_key) {
+    RowView view(&table, row);
+    vector<vector<uint8_t>> entries;
+    entries.reserve(table.indexes.size());
+    for(auto& index : table.indexes) {
+        entries.push_back(index.EntryKey(view, primary_key));
+    }
+    return entries;
+}
+
+vector<vector<uint8_t>> DB::IndexKeys(Table& table, Index& index) {
+    vector<vector<uint8_t>> keys;
+    vector<uint8_t> lo(ToCharVector(index.prefix));
+    vector<uint8_t> hi = PrefixEnd(index.prefix);
+    TableTree(table).Scan(lo, hi, [&](span<const uint8_t> key, span<const uint8_t>) {
+        keys.push_back(vector<uint8_t>(key.begin(), key.end()));
+        return true;
+    });
+    return keys;
+}
+
+void DB::CreateIndex(std::string table_name, std::string column_name) {
+    TableHandle table = OpenTable(table_name);
+    if(table.table == nullptr) {
+        return;
+    }
+    auto column = std::find(table.table->column_names.begin(), table.table->column_names.end(), column_name);
+    if(column == table.table->column_names.end()) {
+        std::cerr << "No column " << column_name << " in table " << table_name << std::endl;
+        return;
+    }
+    uint16_t column_index = column - table.table->column_names.begin();
+    for(auto& index : table.table->indexes) {
+        if(index.column == column_index) {
+            std::cerr << "Column " << column_name << " of table " << table_name << " is already indexed" << std::endl;
+            return;
+        }
+    }
+    uint32_t prefix = FreeIndexPrefix();
+    if(prefix == 0) {
+        std::cerr << "No key prefix left for an index on " << table_name << "." << column_name << std::endl;
+        return;
+    }
+    Index index(table_name, column_index, table.table->schema[column_index], prefix);
+
+    // Entries first, the catalog only lists complete indexes
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    vector<std::pair<vector<uint8_t>, vector<uint8_t>>> entries;
+    vector<uint8_t> lo(ToCharVector(table.table->prefix));
+    vector<uint8_t> hi = PrefixEnd(table.table->prefix);
+    TableTree(*table.table).Scan(lo, hi, [&](span<const uint8_t> key, span<const uint8_t> value) {
+        uint32_t primary_key = FromCharPointer<uint32_t>(key.data() + sizeof(uint32_t));
+        entries.push_back({index.EntryKey(RowView(table.table, value), primary_key), {}});
+        return true;
+    });
+    // Added in one pass, a bulk load would rebuild the whole tree, in the shared tree every other table with it
+    TableTree(*table.table).InsertBatch(std::move(entries));
+
+    storage.Insert(IndexCatalogKey(table_name, column_index), index.Serialize());
+    table.table->indexes.push_back(index);
+    index_prefixes.insert(index.prefix);
+}
+
+void DB::DropIndex(std::string table_name, std::string column_name) {
+    TableHandle table = OpenTable(table_name);
+    Index* index = FindIndex(table, column_name);
+    if(index == nullptr) {
+        return;
+    }
+
+    // Catalog first, entries left by a crash in between belong to no index
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    storage.Delete(IndexCatalogKey(table_name, index->column));
+    WriteBatch batch;
+    for(auto& key : IndexKeys(*table.table, *index)) {
+        batch.Delete(key);
+    }
+    TableTree(*table.table).Write(batch);
+
+    index_prefixes.erase(index->prefix);
+    table.table->indexes.erase(table.table->indexes.begin() + (index - table.table->indexes.data()));
+}
+
+// Primary keys are the last 4 bytes of every entry
+vector<uint32_t> DB::IndexKeyRange(TableHandle table, Index&, vector<uint8_t> lo, vector<uint8_t> hi) {
+    vector<uint32_t> primary_keys;
+    std::lock_guard<std::recursive_mutex> lock(TableLock(*table.table));
+    TableTree(*table.table).Scan(lo, hi, [&](span<const uint8_t> key, span<const uint8_t>) {
+        primary_keys.push_back(FromCharPointer<uint32_t>(key.data() + key.size() - sizeof(uint32_t)));
+        return true;
+    });
+    return primary_keys;
+}
+
+vector<uint32_t> DB::IndexLookup(std::string table_name, std::string column_name, std::any value) {
+    TableHandle table = OpenTable(table_name);
+    Index* index = FindIndex(table, column_name);
+    if(index == nullptr) {
+        return {};
+    }
+    if(!index->CheckValue(value)) {
+        std::cerr << "Bad type of lookup value for " << table_name << "." << column_name << std::endl;
+        return {};
+    }
+    vector<uint8_t> lo = index->ValueKey(value);
+    // Past every primary key after the value
+    vector<uint8_t> hi = lo;
+    hi.insert(hi.end(), sizeof(uint32_t) + 1, 0xff);
+    return IndexKeyRange(table, *index, lo, hi);
+}
+
+vector<uint32_t> DB::IndexRange(std::string table_name, std::string column_name, std::any lo, std::any hi) {
+    TableHandle table = OpenTable(table_name);
+    Index* index = FindIndex(table, column_name);
+    if(index == nullptr) {
+        return {};
+    }
+    if(!index->CheckValue(lo) || !index->CheckValue(hi)) {
+        std::cerr << "Bad type of lookup value for " << table_name << "." << column_name << std::endl;
+        return {};
+    }
+    vector<uint8_t> lo_key = lo.has_value() ? index->ValueKey(lo) : ToCharVector(index->prefix);
+    vector<uint8_t> hi_key = hi.has_value() ? index->ValueKey(hi) : PrefixEnd(index->prefix);
+    return IndexKeyRange(table, *index, lo_key, hi_key);
+}
+
+// Rows are read after the index scan, so rows deleted in between are skipped
+void DB::ScanPrimaryKeys(TableHandle table, vector<uint32_t> primary_keys, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    if(table.table == nullptr) {
+        return;
+    }
+    for(auto primary_key : primary_keys) {
+        auto row = GetRow(table, primary_key);
+        if(row.empty()) {
+            continue;
+        }
+        if(!callback(primary_key, row)) {
+            return;
+        }
+    }
+}
+
+void DB::ScanIndex(std::string table_name, std::string column_name, std::any value, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    ScanPrimaryKeys(OpenTable(table_name), IndexLookup(table_name, column_name, value), callback);
+}
+
+void DB::ScanIndex(std::string table_name, std::string column_name, std::any lo, std::any hi, std::function<bool(uint32_t, vector<std::any>)> callback) {
+    ScanPrimaryKeys(OpenTable(table_name), IndexRange(table_name, column_name, lo, hi), callback);
+}
+
+void DB::BeginTransaction() {
+    storage.BeginTransaction();
+    for(auto& tree : table_trees) {
+        tree.second->BeginTransaction();
+    }
+}
+
+void DB::CommitTransaction() {
+    storage.CommitTransaction();
+    for(auto& tree : table_trees) {
+        tree.second->CommitTransaction();
+    }
+}
+
+// Each tree truncates the file when its pass ends, the last one gets the pages the others left free
+void DB::Compact(uint64_t step_pages) {
+    vector<uint16_t> slots{0};
+    for(auto& tree : table_trees) {
+        slots.push_back(tree.first);
+    }
+    for(auto slot : slots) {
+        BPlusTree& tree = slot == 0 ? storage : *table_trees.at(slot);
+        if(tree.InTransaction()) {
+            std::cerr << "Can not compact during a transaction" << std::endl;
+            return;
+        }
+    }
+    for(auto slot : slots) {
+        BPlusTree& tree = slot == 0 ? storage : *table_trees.at(slot);
+        CompactionStatus status = COMPACTION_STOPPED;
+        while(status == COMPACTION_STOPPED) {
+            std::lock_guard<std::recursive_mutex> lock(*table_locks.at(slot));
+            status = tree.Compact(step_pages);
+        }
+        if(status == COMPACTION_REFUSED) {
+            return;
+        }
+    }
+}
+
+// Trees of dropped tables take their counts with them
+EngineStats DB::Stats() {
+    EngineStats stats = storage.Stats();
+    for(auto& tree : table_trees) {
+        AddTreeStats(stats, tree.second->Stats());
+    }
+    return stats;
+}
+
+void DB::SetTimingSample(uint32_t sample_every) {
+    timing_sample = sample_every;
+    storage.SetTimingSample(sample_every);
+    for(auto& tree : table_trees) {
+        tree.second->SetTimingSample(sample_every);
+    }
+}
 
+vector<uint8_t> DB::PrefixedKey(Table& table, uint32_t primary_key) {
     vector<uint8_t> prefixed_key(ToCharVector(table.prefix));
     for(auto c : ToCharVector(primary_key)) {
         prefixed_key.push_back(c);
@@ -1,6 +1,19 @@
+#include "aggregate.hpp"
 #include "bplustree.hpp"
 #include "table.hpp"
+#include "row.hpp"
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+// Table resolved once through the catalog, row operations on it skip the lookup
+// Invalid after the table is dropped
+struct TableHandle {
+    Table* table;
+};
 
 class DB {
     public: 
@@ -8,13 +21,93 @@ class DB {
         Table meta_table;
         Table table_schema_table;
 
-        DB(std::string filename);
+        // With tree_per_table new tables get their own B+ tree in the file, writes to different tables then run in parallel
+        // Row operations are thread safe, creating and dropping tables is not
+        // io_options picks how pages are read and written and how the file grows, see PageIO
+        DB(std::string filename, bool tree_per_table = false, PageIOOptions io_options = PageIOOptions());
         void CreateTable(Table table);
+        void DropTable(std::string table_name);
+        TableHandle OpenTable(std::string table_name);
+
         void InsertRow(std::string table_name, uint32_t primary_key, vector<std::any> Values);
+        void InsertRow(TableHandle table, uint32_t primary_key, vector<std::any> values);
+        // Rows in any order written in one pass over the table's tree with a single flush, see BPlusTree::InsertBatch
+        // For small batches into a large table, BulkInsertRows rebuilds the whole tree
+        void InsertRows(std::string table_name, vector<std::pair<uint32_t, vector<std::any>>> rows);
+        // Rows sorted by primary key, loaded bottom-up with a single flush
+        void BulkInsertRows(std::string table_name, vector<std::pair<uint32_t, vector<std::any>>> rows);
         void DeleteRow(std::string table_name, uint32_t primary_key);
+        void DeleteRow(TableHandle table, uint32_t primary_key);
         vector<std::any> GetRow(std::string table_name, uint32_t primary_key);
+        vector<std::any> GetRow(TableHandle table, uint32_t primary_key);
+        // Rows in the order of primary_keys, nullopt for missing rows, looked up together in one pass down the tree
+        // threads > 1 splits large batches between threads and prefetch hints pages on the way, see MultiLookup
+        vector<std::optional<vector<std::any>>> GetRows(std::string table_name, span<const uint32_t> primary_keys, uint16_t threads = 1, bool prefetch = true);
+        vector<std::optional<vector<std::any>>> GetRows(TableHandle table, span<const uint32_t> primary_keys, uint16_t threads = 1, bool prefetch = true);
+        // Reads columns in place, valid until the next write, !Valid() if the row is missing
+        RowView GetRowView(TableHandle table, uint32_t primary_key);
+        // Rows with lo <= primary key < hi in key order until callback returns false
+        // The table is locked during the scan, callback may read it but must not write to it
+        void ScanRows(std::string table_name, uint32_t lo, uint32_t hi, std::function<bool(uint32_t, vector<std::any>)> callback);
+        void ScanRows(std::string table_name, std::function<bool(uint32_t, vector<std::any>)> callback);
+
+        // COUNT, SUM, MIN and MAX of an INTEGER column over rows with lo <= primary key < hi matching every predicate
+        // Reads the leaves of the last committed rows in place, threads > 1 splits the key range between disjoint subtrees
+        AggregateResult Aggregate(std::string table_name, std::string column_name, vector<IntegerPredicate> predicates, uint32_t lo, uint32_t hi, uint16_t threads = 1);
+        AggregateResult Aggregate(std::string table_name, std::string column_name, vector<IntegerPredicate> predicates, uint16_t threads = 1);
+
+        // Ordered index over a column, kept up to date by row writes, rows already in the table are added in one batch
+        // Creating and dropping indexes is not thread safe, like tables
+        void CreateIndex(std::string table_name, std::string column_name);
+        void DropIndex(std::string table_name, std::string column_name);
+        // Primary keys in index order of rows with the column equal to value, empty std::any finds NULLs
+        vector<uint32_t> IndexLookup(std::string table_name, std::string column_name, std::any value);
+        // Same for lo <= column < hi, empty lo starts before NULLs and empty hi is unbounded
+        vector<uint32_t> IndexRange(std::string table_name, std::string column_name, std::any lo, std::any hi);
+        // Rows of the lookups in index order until callback returns false
+        void ScanIndex(std::string table_name, std::string column_name, std::any value, std::function<bool(uint32_t, vector<std::any>)> callback);
+        void ScanIndex(std::string table_name, std::string column_name, std::any lo, std::any hi, std::function<bool(uint32_t, vector<std::any>)> callback);
+
+        // Applies to every table, each tree is committed on its own so atomicity is per tree
+        void BeginTransaction();
+        void CommitTransaction();
+
+        // Compacts every tree in steps of step_pages, a table is only locked for one step at a time, see BPlusTree::Compact
+        void Compact(uint64_t step_pages = DEFAULT_COMPACTION_STEP_PAGES);
+
+        // Counters of the file and of every table's tree summed, see BPlusTree::Stats
+        EngineStats Stats();
+        void SetTimingSample(uint32_t sample_every);
     
     private:
-        vector<uint8_t> GetPrefixedKey(std::string table_name, uint32_t primary_key);
+        void LoadCatalog();
+        vector<uint8_t> CatalogKey(std::string table_name);
+        vector<uint8_t> IndexCatalogKey(std::string table_name, uint16_t column);
+        uint32_t FreeIndexPrefix();
+        static bool IsReservedPrefix(uint32_t prefix);
+        static vector<uint8_t> PrefixEnd(uint32_t prefix);
+        Index* FindIndex(TableHandle table, std::string column_name);
+        vector<vector<uint8_t>> IndexEntries(Table& table, span<const uint8_t> row, uint32_t primary_key);
+        vector<vector<uint8_t>> IndexKeys(Table& table, Index& index);
+        vector<uint32_t> IndexKeyRange(TableHandle table, Index& index, vector<uint8_t> lo, vector<uint8_t> hi);
+        void ScanPrimaryKeys(TableHandle table, vector<uint32_t> primary_keys, std::function<bool(uint32_t, vector<std::any>)> callback);
+        vector<uint8_t> PrefixedKey(Table& table, uint32_t primary_key);
+        BPlusTree& TableTree(Table& table);
+        std::recursive_mutex& TableLock(Table& table);
+        void OpenTableTree(uint16_t root_slot);
+        uint16_t FreeRootSlot();
+        void ScanKeyRange(TableHandle table, vector<uint8_t> lo_suffix, vector<uint8_t> hi_suffix, std::function<bool(uint32_t, vector<std::any>)> callback);
+        AggregateResult AggregateKeyRange(TableHandle table, std::string column_name, vector<IntegerPredicate> predicates, vector<uint8_t> lo_suffix, vector<uint8_t> hi_suffix, uint16_t threads);
+        bool IsIntegerColumn(Table& table, std::string column_name);
+
+        // Catalog cache, the B+ tree is only read for it at open
+        std::unordered_map<std::string, Table> tables;
+        std::unordered_map<uint32_t, Table*> tables_by_prefix;
+        std::unordered_set<uint32_t> index_prefixes;
 
+        bool tree_per_table;
+        uint32_t timing_sample;
+        // Keyed by root slot, slot 0 is storage which holds the catalog and every table without its own tree
+        std::unordered_map<uint16_t, std::unique_ptr<BPlusTree>> table_trees;
+        std::unordered_map<uint16_t, std::unique_ptr<std::recursive_mutex>> table_locks;
 };
\ No newline at end of file
@@ -3,99 +3,431 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <deque>
 #include <fcntl.h>
 #include <filesystem>
 #include <iostream>
 #include <iterator>
-#include <set>
 #include <ostream>
-#include <sys/mman.h>
+#include <stdexcept>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 #include "bitutils.hpp"
 #include "bplusnode.hpp"
+#include "overflow.hpp"
 
 // Disk manager
 
-DiskManager::DiskManager(std::string filename) {
+DiskManager::DiskManager(std::string filename, uint64_t cache_bytes, PageIOOptions io_options) : cache(cache_bytes) {
     this->filename = filename;
+    growth_pages = io_options.growth_pages;
+    allocated_pages = 0;
+    generation = 0;
+    roots.assign(ROOT_SLOTS, 0);
+    for(auto& shard : shards) {
+        shard.next_chunk = 0;
+    }
+    // An existing file keeps its own page size, read from the metadata before the file is mapped
     if(std::filesystem::exists(filename)) {
         file_descriptor = open(filename.c_str(), O_RDWR, S_IRUSR | S_IWUSR);
-        metadata_page = static_cast<uint8_t*>(mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0));
+        // Guessing a page size would read every page at the wrong offsets, so the file is refused
+        vector<uint8_t> header(METADATA_HEADER_BYTES);
+        if(pread(file_descriptor, header.data(), METADATA_HEADER_BYTES, 0) != (ssize_t)METADATA_HEADER_BYTES) {
+            std::cerr << "Failed to read the metadata header of " << filename << std::endl;
+            close(file_descriptor);
+            throw std::runtime_error("Can not open " + filename);
+        }
+        page_count = FromCharPointer<uint64_t>(header.data());
+        page_size = FromCharPointer<uint64_t>(header.data() + 2 * sizeof(uint64_t));
+        if(!IsValidPageSize(page_size)) {
+            std::cerr << "Unsupported page size " << page_size << " in " << filename << std::endl;
+            close(file_descriptor);
+            throw std::runtime_error("Can not open " + filename);
+        }
+        pages_per_bitmap = (page_size - BITMAP_HEADER_BYTES) * 8;
+        io = OpenPageIO(io_options, filename, file_descriptor, page_count, page_size);
         LoadMetadata();
-        metadata_page = static_cast<uint8_t*>(mmap(NULL, 4096 * page_count, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0));
-        FindOrphanedNodes();
+        LoadBitmap();
     } else {
         file_descriptor = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-        page_count = 1; // one reseved for metadata
-        metadata_page = nullptr;
-        root = 0;
+        page_count = 0;
+        page_size = io_options.page_size;
+        if(!IsValidPageSize(page_size)) {
+            std::cerr << "Page size must be a power of two from " << MIN_PAGE_SIZE << " to " << MAX_PAGE_SIZE << ", using " << DEFAULT_PAGE_SIZE << std::endl;
+            page_size = DEFAULT_PAGE_SIZE;
+        }
+        pages_per_bitmap = (page_size - BITMAP_HEADER_BYTES) * 8;
+        io = OpenPageIO(io_options, filename, file_descriptor, page_count, page_size);
         SetFilePageCount(8);
+        ToCharPointer(page_size, io->ResidentPage(0) + 2 * sizeof(uint64_t));
     }
 }
 
+// Snapshots can not outlive the manager, so nothing retired is still in use
 DiskManager::~DiskManager() {
+    ReleaseRetiredPages(true);
+    SyncBitmap();
     close(file_descriptor);
 }
 
 void DiskManager::SetFilePageCount(uint64_t n_pages) {
     if(n_pages > page_count) {
-        ftruncate(file_descriptor, n_pages * 4096);
-        metadata_page = static_cast<uint8_t*>(mmap(NULL, 4096 * n_pages, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0));
-        for(int i = page_count; i < n_pages; i++) {
-            free_pages.push_back(i * 4096);
-        }
+        io->Grow(n_pages);
+        file_grows.Add();
     }
     else {
         std::cerr << "Reducing number of pages would lose data" << std::endl;
     }
     page_count = n_pages;
-    vector<uint8_t> serialized_page_count = ToCharVector(page_count);
-    std::copy(serialized_page_count.begin(), serialized_page_count.end(), metadata_page);   
+    for(size_t i = 0; i < bitmap_pages.size(); i++) {
+        bitmap_data[i] = io->ResidentPage(bitmap_pages[i]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        vector<uint8_t> serialized_page_count = ToCharVector(page_count);
+        std::copy(serialized_page_count.begin(), serialized_page_count.end(), io->ResidentPage(0));
+    }
+    while(bitmap_pages.size() * pages_per_bitmap < page_count) {
+        AddBitmapPage();
+    }
 }
 
-uint64_t DiskManager::GetFreePage() {
-    if(free_pages.size() == 0) {
-        SetFilePageCount(page_count * 2);
+// Bitmap pages sit at the start of the range they cover, that range is always new when the file grows into it
+void DiskManager::AddBitmapPage() {
+    uint64_t page_index = std::max<uint64_t>(1, bitmap_pages.size() * pages_per_bitmap);
+    uint64_t page = page_index * page_size;
+    uint8_t* data = io->ResidentPage(page);
+    std::fill(data, data + page_size, 0);
+
+    vector<uint8_t> serialized_page = ToCharVector(page);
+    if(bitmap_pages.empty()) {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        std::copy(serialized_page.begin(), serialized_page.end(), io->ResidentPage(0) + sizeof(uint64_t));
     }
-    auto page = free_pages.front();
-    std::fill(metadata_page + page, metadata_page + page + 4096, 0);
-    free_pages.pop_front();
-    return page;
+    else {
+        std::lock_guard<std::mutex> lock(bitmap_mutex);
+        std::copy(serialized_page.begin(), serialized_page.end(), bitmap_data.back());
+        dirty_bitmap_pages.insert(bitmap_pages.back());
+    }
+    bitmap_pages.push_back(page);
+    bitmap_data.push_back(data);
+    if(page_index == 1) {
+        SetPageAllocated(0, true);
+    }
+    SetPageAllocated(page_index, true);
+}
+
+void DiskManager::LoadBitmap() {
+    uint64_t page = FromCharPointer<uint64_t>(io->ResidentPage(0) + sizeof(uint64_t));
+    while(page != 0) {
+        bitmap_pages.push_back(page);
+        bitmap_data.push_back(io->ResidentPage(page));
+        page = FromCharPointer<uint64_t>(bitmap_data.back());
+    }
+    if(bitmap_pages.size() * pages_per_bitmap < page_count) {
+        std::cerr << "Free space map does not cover the file" << std::endl;
+        return;
+    }
+    for(uint64_t i = 0; i < page_count; i++) {
+        allocated_pages += IsPageAllocated(i);
+    }
+}
+
+uint8_t* DiskManager::Bitmap(uint64_t page_index) {
+    return bitmap_data[page_index / pages_per_bitmap] + BITMAP_HEADER_BYTES;
+}
+
+bool DiskManager::IsPageAllocated(uint64_t page_index) {
+    uint8_t* bitmap = Bitmap(page_index);
+    uint64_t bit = page_index % pages_per_bitmap;
+    return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+// Chunks are whole bytes of the bitmap, so shards never write the same byte
+// Bits change under bitmap_mutex so a page is never written out while it changes
+void DiskManager::SetPageAllocated(uint64_t page_index, bool allocated) {
+    uint64_t bitmap_page = bitmap_pages[page_index / pages_per_bitmap];
+    uint8_t* bitmap = Bitmap(page_index);
+    uint64_t bit = page_index % pages_per_bitmap;
+    std::lock_guard<std::mutex> lock(bitmap_mutex);
+    if(((bitmap[bit / 8] >> (bit % 8)) & 1) != allocated) {
+        allocated_pages += allocated ? 1 : -1;
+    }
+    if(allocated) {
+        bitmap[bit / 8] |= 1 << (bit % 8);
+    }
+    else {
+        bitmap[bit / 8] &= ~(1 << (bit % 8));
+    }
+    dirty_bitmap_pages.insert(bitmap_page);
 }
 
-uint64_t DiskManager::WriteNode(BPlusNode node) {
-    auto page = GetFreePage();
-    auto node_data = node.Serialize();
-    std::copy(node_data.begin(), node_data.end(), metadata_page + page);
-    msync(metadata_page + page, 4096, MS_SYNC);
+// First clear bit in [from, to), skipping full words, 0 if there is none
+uint64_t DiskManager::FindFreePage(uint64_t from, uint64_t to) {
+    uint64_t i = from;
+    while(i < to) {
+        uint64_t bit = i % pages_per_bitmap;
+        uint8_t* bitmap = Bitmap(i);
+        if(bit % 64 == 0 && i + 64 <= to) {
+            uint64_t word;
+            std::memcpy(&word, bitmap + bit / 8, sizeof(word));
+            if(word == UINT64_MAX) {
+                i += 64;
+                continue;
+            }
+        }
+        if(bit % 8 == 0 && i + 8 <= to && bitmap[bit / 8] == 0xFF) {
+            i += 8;
+            continue;
+        }
+        if(((bitmap[bit / 8] >> (bit % 8)) & 1) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return 0;
+}
+
+// Shard i owns chunks i, i + ALLOCATION_SHARDS, ..., scanned from the last one it allocated in
+uint64_t DiskManager::AllocateInShard(uint16_t shard_index) {
+    AllocationShard& shard = shards[shard_index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t chunks = (page_count + SHARD_CHUNK_PAGES - 1) / SHARD_CHUNK_PAGES;
+    if(chunks <= shard_index) {
+        return 0;
+    }
+    uint64_t owned_chunks = (chunks - shard_index - 1) / ALLOCATION_SHARDS + 1;
+    for(uint64_t n = 0; n < owned_chunks; n++) {
+        uint64_t chunk = (shard.next_chunk + n) % owned_chunks;
+        uint64_t chunk_start = (chunk * ALLOCATION_SHARDS + shard_index) * SHARD_CHUNK_PAGES;
+        uint64_t page_index = FindFreePage(chunk_start, std::min<uint64_t>(chunk_start + SHARD_CHUNK_PAGES, page_count));
+        if(page_index != 0) {
+            SetPageAllocated(page_index, true);
+            shard.next_chunk = chunk;
+            return page_index;
+        }
+    }
+    return 0;
+}
+
+// Tries the hinted shard first, then the others, then pages retired since the last commit, then grows the file
+uint64_t DiskManager::GetFreePage(uint16_t shard_hint) {
+    while(true) {
+        uint64_t seen_page_count;
+        {
+            std::shared_lock<std::shared_mutex> lock(mapping_mutex);
+            for(uint16_t i = 0; i < ALLOCATION_SHARDS; i++) {
+                uint64_t page_index = AllocateInShard((shard_hint + i) % ALLOCATION_SHARDS);
+                if(page_index != 0) {
+                    return page_index * page_size;
+                }
+            }
+            seen_page_count = page_count;
+        }
+        if(ReleaseRetiredPages(false)) {
+            continue;
+        }
+        GrowFile(seen_page_count);
+    }
+}
+
+// Unless another thread already grew it past seen_page_count
+void DiskManager::GrowFile(uint64_t seen_page_count) {
+    std::unique_lock<std::shared_mutex> lock(mapping_mutex);
+    if(page_count == seen_page_count) {
+        SetFilePageCount(growth_pages > 0 ? page_count + growth_pages : page_count * 2);
+    }
+}
+
+// Chunks are scanned in file order, each under the lock of the shard owning it
+// The file grows when the range runs to its end and nothing is free
+uint64_t DiskManager::GetLowestFreePage(uint64_t from, uint64_t below) {
+    while(true) {
+        uint64_t seen_page_count;
+        {
+            std::shared_lock<std::shared_mutex> mapping_lock(mapping_mutex);
+            uint64_t end = std::min<uint64_t>(below / page_size, page_count);
+            uint64_t start = std::max<uint64_t>(1, from / page_size);
+            while(start < end) {
+                uint64_t chunk = start / SHARD_CHUNK_PAGES;
+                uint64_t chunk_end = std::min<uint64_t>((chunk + 1) * SHARD_CHUNK_PAGES, end);
+                AllocationShard& shard = shards[chunk % ALLOCATION_SHARDS];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                uint64_t page_index = FindFreePage(start, chunk_end);
+                if(page_index != 0) {
+                    SetPageAllocated(page_index, true);
+                    return page_index * page_size;
+                }
+                start = chunk_end;
+            }
+            if(below / page_size < page_count) {
+                return 0;
+            }
+            seen_page_count = page_count;
+        }
+        GrowFile(seen_page_count);
+    }
+}
+
+uint64_t DiskManager::WriteNode(BPlusNode node, uint16_t shard_hint) {
+    auto page = GetFreePage(shard_hint);
+    WriteNodeAt(page, std::move(node));
     return page;
 }
 
-BPlusNode DiskManager::GetNode(uint64_t pointer) {
-    BPlusNode node(metadata_page + pointer);
+void DiskManager::WriteNodeAt(uint64_t page, BPlusNode node) {
+    io->WritePage(page, node.Serialize());
+    pages_written.Add();
+    node.node_pointer = page;
+    cache.Put(page, std::make_shared<BPlusNode>(std::move(node)));
+}
+
+std::shared_ptr<const BPlusNode> DiskManager::GetNode(uint64_t pointer) {
+    std::shared_ptr<const BPlusNode> cached = cache.Get(pointer);
+    if(cached) {
+        return cached;
+    }
+    PageHandle page = io->ReadPage(pointer);
+    pages_read.Add();
+    nodes_decoded.Add();
+    auto node = std::make_shared<BPlusNode>(page.get());
+    node->node_pointer = pointer;
+    cache.Put(pointer, node);
+    return node;
+}
+
+BPlusNode DiskManager::TakeNode(uint64_t pointer) {
+    BPlusNode node(BNodeType::LEAF);
+    if(cache.Take(pointer, node)) {
+        return node;
+    }
+    PageHandle page = io->ReadPage(pointer);
+    pages_read.Add();
+    nodes_decoded.Add();
+    node = BPlusNode(page.get());
     node.node_pointer = pointer;
     return node;
 }
 
+void DiskManager::Flush(uint64_t start, uint64_t length) {
+    io->Sync(start, length);
+    syncs.Add();
+    bytes_synced.Add(length);
+}
+
+NodeView DiskManager::GetNodeView(uint64_t pointer) {
+    pages_read.Add();
+    return NodeView(io->ReadPage(pointer));
+}
+
+PageHandle DiskManager::GetPage(uint64_t pointer) {
+    pages_read.Add();
+    return io->ReadPage(pointer);
+}
+
+void DiskManager::WritePage(uint64_t pointer, const vector<uint8_t>& data) {
+    io->WritePage(pointer, data);
+    pages_written.Add();
+}
+
+uint64_t DiskManager::PageSize() {
+    return page_size;
+}
+
+void DiskManager::Prefetch(uint64_t pointer, uint64_t n_pages) {
+    io->Prefetch(pointer, n_pages);
+}
+
 void DiskManager::LoadMetadata() {
-    this->page_count = FromCharPointer<uint64_t>(metadata_page);
-    this->root = FromCharPointer<uint64_t>(metadata_page + sizeof(uint64_t));
+    uint8_t* metadata_page = io->ResidentPage(0);
+    for(uint16_t slot = 0; slot < ROOT_SLOTS; slot++) {
+        roots[slot] = FromCharPointer<uint64_t>(metadata_page + METADATA_HEADER_BYTES + slot * sizeof(uint64_t));
+    }
 }
 
-uint64_t DiskManager::GetRoot() {
-    return FromCharPointer<uint64_t>(metadata_page + sizeof(uint64_t));
+uint64_t DiskManager::GetRoot(uint16_t slot) {
+    return roots[slot];
 }
 
-void DiskManager::SetRoot(uint64_t new_root) {
-    if(root != 0)
+// The allocations made for the new root are synced with it, pages it replaced are retired afterwards
+void DiskManager::SetRoot(uint16_t slot, uint64_t new_root, const vector<uint64_t>& obsolete_pages) {
+    SyncBitmap();
     {
-        MarkPageAsObsolete(root);
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        vector<uint8_t> Serialized_root = ToCharVector(new_root);
+        std::copy(Serialized_root.begin(), Serialized_root.end(), io->ResidentPage(0) + METADATA_HEADER_BYTES + slot * sizeof(uint64_t));
+        io->SyncResidentPage(0);
+        syncs.Add();
+        bytes_synced.Add(page_size);
     }
-    this->root = new_root;
-    vector<uint8_t> Serialized_root = ToCharVector(new_root);
-    std::copy(Serialized_root.begin(), Serialized_root.end(), metadata_page + sizeof(uint64_t));
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        roots[slot] = new_root;
+        for(auto page : obsolete_pages) {
+            retired.push_back({generation, page});
+        }
+        generation++;
+    }
+    ReleaseRetiredPages(false);
+}
+
+uint64_t DiskManager::PinRoot(uint16_t slot, uint64_t& pinned_root) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    pinned_root = roots[slot];
+    snapshots.insert(generation);
+    return generation;
+}
+
+void DiskManager::UnpinRoot(uint64_t generation) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    snapshots.erase(snapshots.find(generation));
+}
+
+// Held for the whole sync, a writer finding nothing dirty knows its bits are on disk
+void DiskManager::SyncBitmap() {
+    std::lock_guard<std::mutex> lock(bitmap_mutex);
+    for(auto page : dirty_bitmap_pages) {
+        io->SyncResidentPage(page);
+        syncs.Add();
+        bytes_synced.Add(page_size);
+    }
+    dirty_bitmap_pages.clear();
+}
+
+// Retired pages no snapshot can reach anymore go back to the free space map
+// Cleared bits reach the disk with the next commit, until then the pages only look leaked
+bool DiskManager::ReleaseRetiredPages(bool all) {
+    vector<uint64_t> released;
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        uint64_t oldest = snapshots.empty() || all ? generation : *snapshots.begin();
+        while(!retired.empty() && retired.front().first < oldest) {
+            released.push_back(retired.front().second);
+            retired.pop_front();
+        }
+    }
+    for(auto page : released) {
+        ReleasePage(page);
+    }
+    return !released.empty();
+}
+
+void DiskManager::ReleasePage(uint64_t pointer) {
+    cache.Erase(pointer);
+    uint64_t page_index = pointer / page_size;
+    uint64_t chunk = page_index / SHARD_CHUNK_PAGES;
+    std::shared_lock<std::shared_mutex> mapping_lock(mapping_mutex);
+    AllocationShard& shard = shards[chunk % ALLOCATION_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    SetPageAllocated(page_index, false);
+    pages_freed.Add();
+    shard.next_chunk = std::min<uint64_t>(shard.next_chunk, chunk / ALLOCATION_SHARDS);
+}
+
+void DiskManager::FreePage(uint64_t pointer) {
+    ReleasePage(pointer);
 }
 
 void DiskManager::DeleteDataFile() {
@@ -104,25 +436,136 @@ void DiskManager::DeleteDataFile() {
     remove(filename.c_str());
 }
 
-// TODO concurrency
-void DiskManager::MarkPageAsObsolete(uint64_t pointer) {
-    free_pages.push_back(pointer);
+CacheStats DiskManager::GetCacheStats() {
+    return cache.GetStats();
+}
+
+EngineStats DiskManager::GetStats() {
+    EngineStats stats{};
+    stats.pages_read = pages_read.Read();
+    stats.nodes_decoded = nodes_decoded.Read();
+    stats.pages_written = pages_written.Read();
+    stats.syncs = syncs.Read();
+    stats.bytes_synced = bytes_synced.Read();
+    stats.pages_freed = pages_freed.Read();
+    stats.file_grows = file_grows.Read();
+    {
+        std::shared_lock<std::shared_mutex> lock(mapping_mutex);
+        stats.file_pages = page_count;
+        stats.free_pages = page_count - allocated_pages;
+    }
+    stats.cache = cache.GetStats();
+    return stats;
 }
 
-void DiskManager::FindOrphanedNodes() {
-    std::set<uint64_t> not_orphaned;
+uint64_t DiskManager::VerifyFreeSpace(bool repair) {
+    vector<uint64_t> leaked;
+    {
+        std::unique_lock<std::shared_mutex> mapping_lock(mapping_mutex);
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        vector<bool> in_use(page_count, false);
+        in_use[0] = true;
+        for(auto page : bitmap_pages) {
+            in_use[page / page_size] = true;
+        }
+        for(auto& page : retired) {
+            in_use[page.second / page_size] = true;
+        }
+
+        std::deque<uint64_t> searched_nodes;
+        for(auto root : roots) {
+            if(root != 0) {
+                searched_nodes.push_back(root);
+            }
+        }
+        while(!searched_nodes.empty()) {
+            uint64_t pointer = searched_nodes.front();
+            searched_nodes.pop_front();
+            in_use[pointer / page_size] = true;
+            if(!IsPageAllocated(pointer / page_size)) {
+                std::cerr << "Reachable page " << pointer << " is marked free" << std::endl;
+                if(repair) {
+                    SetPageAllocated(pointer / page_size, true);
+                }
+            }
+            NodeView node = GetNodeView(pointer);
+            for(uint16_t i = 0; i < node.KeyCount(); i++) {
+                if(node.Type() == BNodeType::NODE) {
+                    searched_nodes.push_back(node.Pointer(i));
+                    continue;
+                }
+                if(!IsOverflowValue(node.Value(i))) {
+                    continue;
+                }
+                for(auto page : OverflowPages(*this, ParseOverflowValue(node.Value(i)))) {
+                    in_use[page / page_size] = true;
+                    if(!IsPageAllocated(page / page_size)) {
+                        std::cerr << "Overflow page " << page << " is marked free" << std::endl;
+                        if(repair) {
+                            SetPageAllocated(page / page_size, true);
+                        }
+                    }
+                }
+            }
+        }
 
-    std::deque<BPlusNode> searched_nodes;
-    searched_nodes.push_back(GetNode(root));
-    not_orphaned.insert(root);
-    for(auto p : searched_nodes.front().pointer_map) {
-        searched_nodes.push_back(GetNode(p.second));
-        not_orphaned.insert(p.second);
+        for(uint64_t i = 1; i < page_count; i++) {
+            if(!in_use[i] && IsPageAllocated(i)) {
+                leaked.push_back(i * page_size);
+            }
+        }
+    }
+    if(repair) {
+        for(auto page : leaked) {
+            ReleasePage(page);
+        }
+        SyncBitmap();
     }
+    return leaked.size();
+}
 
-    for(int i = 1; i < page_count; i++) {
-        if(not_orphaned.count(i * 4096) == 0) {
-            MarkPageAsObsolete(i * 4096);
+// The shorter free space map and page count are synced before the file is cut, a crash in between leaves a longer file than recorded
+uint64_t DiskManager::TruncateFreeTail() {
+    ReleaseRetiredPages(false);
+    std::unique_lock<std::shared_mutex> mapping_lock(mapping_mutex);
+    uint64_t end = page_count;
+    uint64_t bitmaps = bitmap_pages.size();
+    while(end > 1) {
+        if(bitmaps > 1 && end - 1 == bitmap_pages[bitmaps - 1] / page_size) {
+            bitmaps--;
+        }
+        else if(IsPageAllocated(end - 1)) {
+            break;
         }
+        end--;
+    }
+    end = std::max<uint64_t>(end, 8);
+    if(end >= page_count) {
+        return 0;
     }
-}
\ No newline at end of file
+
+    while(bitmap_pages.size() > bitmaps) {
+        SetPageAllocated(bitmap_pages.back() / page_size, false);
+        bitmap_pages.pop_back();
+        bitmap_data.pop_back();
+        std::lock_guard<std::mutex> lock(bitmap_mutex);
+        std::fill(bitmap_data.back(), bitmap_data.back() + sizeof(uint64_t), 0);
+        dirty_bitmap_pages.insert(bitmap_pages.back());
+    }
+    {
+        std::lock_guard<std::mutex> lock(bitmap_mutex);
+        std::erase_if(dirty_bitmap_pages, [&](uint64_t page) { return page >= end * page_size; });
+    }
+    SyncBitmap();
+    {
+        std::lock_guard<std::mutex> lock(metadata_mutex);
+        ToCharPointer(end, io->ResidentPage(0));
+        io->SyncResidentPage(0);
+        syncs.Add();
+        bytes_synced.Add(page_size);
+    }
+    io->Shrink(end);
+    uint64_t removed = page_count - end;
+    page_count = end;
+    return removed;
+}
@@ -1,40 +1,144 @@
 #ifndef DISKMANAGER
 #define DISKMANAGER
 
+#include <atomic>
 #include <cstdint>
-#include <string>
 #include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <set>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
 #include "bplusnode.hpp"
+#include "nodeview.hpp"
+#include "pagecache.hpp"
+#include "pageio.hpp"
+#include "stats.hpp"
 
 using std::string;
-using std::deque;
+using std::vector;
+
+/*
+    Metadata page
+    | page_count | first bitmap page | page size | root slots         |
+    | 8B         | 8B                | 8B        | ROOT_SLOTS * 8B    |
+
+    Bitmap page, one bit per page, set while the page is in use
+    | next bitmap page | bits                       |
+    | 8B               | (page size - 8B) * 8 bits  |
+*/
+#define METADATA_HEADER_BYTES 24
+// As many as fit in the smallest page, so every page size has the same slots
+#define ROOT_SLOTS ((MIN_PAGE_SIZE - METADATA_HEADER_BYTES) / sizeof(uint64_t))
+#define BITMAP_HEADER_BYTES 8
+// Allocation shards own interleaved chunks of the file, writers start in the shard of their tree
+#define ALLOCATION_SHARDS 16
+#define SHARD_CHUNK_PAGES 512
 
 // Handles IO
+// Writers of different root slots may use it from different threads, one writer per slot
 class DiskManager {
     public:
-        DiskManager(std::string filename);
+        // Throws std::runtime_error when an existing file has an unreadable header or page size
+        DiskManager(std::string filename, uint64_t cache_bytes = DEFAULT_CACHE_BYTES, PageIOOptions io_options = PageIOOptions());
         ~DiskManager();
-        uint64_t GetRoot();
-        void SetRoot(uint64_t new_root);
-        BPlusNode GetNode(uint64_t pointer);
-        uint64_t GetFreePage();
-        uint64_t WriteNode(BPlusNode node);
+        uint64_t GetRoot(uint16_t slot);
+        // Publishes the root of a slot, pages the slot's writer replaced to get there are retired with it
+        void SetRoot(uint16_t slot, uint64_t new_root, const vector<uint64_t>& obsolete_pages);
+        // Shared with the node cache, callers that change the node copy it or use TakeNode
+        std::shared_ptr<const BPlusNode> GetNode(uint64_t pointer);
+        // GetNode for a node the caller is about to replace, moved out of the cache rather than copied
+        BPlusNode TakeNode(uint64_t pointer);
+        NodeView GetNodeView(uint64_t pointer);
+        // Raw pages outside the tree, such as overflow pages
+        PageHandle GetPage(uint64_t pointer);
+        // Whole page, zero padded, at a page taken with GetFreePage
+        void WritePage(uint64_t pointer, const vector<uint8_t>& data);
+        // Set when the file is created, PageIOOptions::page_size
+        uint64_t PageSize();
+        void Prefetch(uint64_t pointer, uint64_t n_pages = 1);
+        uint64_t GetFreePage(uint16_t shard_hint);
+        // Straight back to the free space map, for pages no published root has reached
+        void FreePage(uint64_t pointer);
+        // Lowest free page in [from, below), taken regardless of shards so the file fills from the start
+        // 0 if there is none, unless below is past the end of the file, which then grows
+        uint64_t GetLowestFreePage(uint64_t from, uint64_t below);
+        uint64_t WriteNode(BPlusNode node, uint16_t shard_hint);
+        // WriteNode at a page already taken
+        void WriteNodeAt(uint64_t page, BPlusNode node);
+        void Flush(uint64_t start, uint64_t length);
 
-        void MarkPageAsObsolete(uint64_t pointer);
-        void FindOrphanedNodes();
+        // Published root of a slot and its generation, pages reachable from it are kept until it is unpinned
+        // Thread safe along with GetNodeView and Prefetch
+        uint64_t PinRoot(uint16_t slot, uint64_t& pinned_root);
+        void UnpinRoot(uint64_t generation);
+
+        // Offline check of the free space map against the pages reachable from every published root
+        // No slot may have uncommitted writes, returns the number of leaked pages, released when repair is set
+        uint64_t VerifyFreeSpace(bool repair);
+        // Cuts free pages off the end of the file once every retired page no snapshot needs is released
+        // Bitmap pages left covering only free pages go with them, returns the number of pages removed
+        uint64_t TruncateFreeTail();
 
         void DeleteDataFile();
+
+        CacheStats GetCacheStats();
+        // File level counters, the tree fields are left zero
+        EngineStats GetStats();
     private:
         void SetFilePageCount(uint64_t n_pages);
+        void GrowFile(uint64_t seen_page_count);
         void LoadMetadata();
+        void LoadBitmap();
+        void AddBitmapPage();
+        void SyncBitmap();
+        bool ReleaseRetiredPages(bool all);
+        void ReleasePage(uint64_t pointer);
+        bool IsPageAllocated(uint64_t page_index);
+        void SetPageAllocated(uint64_t page_index, bool allocated);
+        uint8_t* Bitmap(uint64_t page_index);
+        uint64_t FindFreePage(uint64_t from, uint64_t to);
+        uint64_t AllocateInShard(uint16_t shard_index);
         std::string filename;
         int file_descriptor;
 
-        uint8_t* metadata_page;
-        uint64_t root;
+        std::unique_ptr<PageIO> io;
+        uint64_t page_size;
+        uint64_t pages_per_bitmap;
+        uint64_t growth_pages;
+        vector<uint64_t> roots;
         uint64_t page_count;
-        deque<uint64_t> free_pages;
+        vector<uint64_t> bitmap_pages;
+        vector<uint8_t*> bitmap_data; // resident copies of bitmap_pages, refreshed when the file grows
+        PageCache cache;
+
+        // Held shared to allocate or release pages, exclusively to grow the file
+        std::shared_mutex mapping_mutex;
+        struct AllocationShard {
+            std::mutex mutex;
+            uint64_t next_chunk; // among the chunks owned by the shard
+        };
+        AllocationShard shards[ALLOCATION_SHARDS];
+        std::mutex bitmap_mutex;
+        std::mutex metadata_mutex;
+        std::set<uint64_t> dirty_bitmap_pages;
+
+        std::mutex snapshot_mutex;
+        uint64_t generation;
+        std::multiset<uint64_t> snapshots;
+        // (generation of the last root that could reach the page, page), oldest first
+        std::deque<std::pair<uint64_t, uint64_t>> retired;
 
+        Counter pages_read;
+        Counter nodes_decoded;
+        Counter pages_written;
+        Counter syncs;
+        Counter bytes_synced;
+        Counter pages_freed;
+        Counter file_grows;
+        std::atomic<uint64_t> allocated_pages;
 };
 
-#endif
\ No newline at end of file
+#endif
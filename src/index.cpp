@@ -0,0 +1,103 @@
+#include "index.hpp"
+#include <any>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include "bitutils.hpp"
+#include "row.hpp"
+
+Index::Index(std::string table_name, uint16_t column, DataType type, uint32_t prefix) {
+    this->table_name = table_name;
+    this->column = column;
+    this->type = type;
+    this->prefix = prefix;
+}
+
+Index::Index(std::span<const uint8_t> data) {
+    prefix = FromCharPointer<uint32_t>(data.data());
+    for(int i = 0; i < data[4]; i++) {
+        table_name += data[5 + i];
+    }
+    column = FromCharPointer<uint16_t>(data.data() + 5 + data[4]);
+    type = static_cast<DataType>(data[7 + data[4]]);
+}
+
+/*
+    | prefix | table name | column | column type |
+    | 4B     | len + name | 2B     | 1B          |
+*/
+vector<uint8_t> Index::Serialize() {
+    vector<uint8_t> serialized = ToCharVector(prefix);
+    serialized.push_back(table_name.size());
+    serialized.insert(serialized.end(), table_name.begin(), table_name.end());
+    for(auto c : ToCharVector(column)) {
+        serialized.push_back(c);
+    }
+    serialized.push_back(type);
+    return serialized;
+}
+
+void Index::AppendInteger(vector<uint8_t>& key, uint64_t value) {
+    key.push_back(1);
+    for(auto c : ToCharVector(value)) {
+        key.push_back(c);
+    }
+}
+
+void Index::AppendString(vector<uint8_t>& key, std::string_view value) {
+    key.push_back(1);
+    for(auto c : value) {
+        key.push_back(c);
+        if(c == 0) {
+            key.push_back(0xFF);
+        }
+    }
+    key.push_back(0);
+    key.push_back(1);
+}
+
+// NULL is a 0 flag alone, so it sorts before every value
+vector<uint8_t> Index::EntryKey(const RowView& row, uint32_t primary_key) const {
+    if(!row.Valid()) {
+        return {};
+    }
+    vector<uint8_t> key = ToCharVector(prefix);
+    if(row.IsNull(column)) {
+        key.push_back(0);
+    }
+    else if(type == DataType::INTEGER) {
+        AppendInteger(key, row.GetInt(column));
+    }
+    else {
+        AppendString(key, row.GetString(column));
+    }
+    for(auto c : ToCharVector(primary_key)) {
+        key.push_back(c);
+    }
+    return key;
+}
+
+vector<uint8_t> Index::ValueKey(const std::any& value) const {
+    vector<uint8_t> key = ToCharVector(prefix);
+    if(!value.has_value()) {
+        key.push_back(0);
+    }
+    else if(type == DataType::INTEGER) {
+        AppendInteger(key, std::any_cast<uint64_t>(value));
+    }
+    else {
+        AppendString(key, std::any_cast<const std::string&>(value));
+    }
+    return key;
+}
+
+bool Index::CheckValue(const std::any& value) const {
+    if(!value.has_value()) {
+        return true;
+    }
+    if(type == DataType::INTEGER) {
+        return value.type() == typeid(uint64_t);
+    }
+    return value.type() == typeid(std::string);
+}
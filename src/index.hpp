@@ -0,0 +1,44 @@
+#ifndef INDEX
+#define INDEX
+
+#include <any>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "record.hpp"
+
+using std::vector;
+
+class RowView;
+
+// Ordered secondary index over one column of a table, kept in the table's tree under its own prefix
+// Entry key, the value is empty
+// | prefix | null flag | column value | primary key |
+// | 4B     | 1B        | nB           | 4B          |
+// INTEGER values are 8B big endian, STRING values escape 0x00 as 0x00 0xFF and end with 0x00 0x01
+class Index {
+    public:
+        Index(std::string table_name, uint16_t column, DataType type, uint32_t prefix);
+        Index(std::span<const uint8_t> data);
+
+        std::string table_name;
+        uint16_t column;
+        DataType type;
+        uint32_t prefix;
+
+        vector<uint8_t> Serialize();
+
+        // Entry of a row, empty if the row is not valid
+        vector<uint8_t> EntryKey(const RowView& row, uint32_t primary_key) const;
+        // Entries of rows with the value start with it and sort with it, empty std::any is NULL
+        vector<uint8_t> ValueKey(const std::any& value) const;
+        bool CheckValue(const std::any& value) const;
+
+    private:
+        static void AppendInteger(vector<uint8_t>& key, uint64_t value);
+        static void AppendString(vector<uint8_t>& key, std::string_view value);
+};
+
+#endif
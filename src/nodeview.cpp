@@ -0,0 +1,177 @@
+#include "nodeview.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "bitutils.hpp"
+
+int CompareKeys(span<const uint8_t> a, span<const uint8_t> b) {
+    size_t common = std::min(a.size(), b.size());
+    if(common > 0) {
+        int result = memcmp(a.data(), b.data(), common);
+        if(result != 0) {
+            return result;
+        }
+    }
+    if(a.size() == b.size()) {
+        return 0;
+    }
+    return a.size() < b.size() ? -1 : 1;
+}
+
+size_t CommonPrefixLength(span<const uint8_t> a, span<const uint8_t> b) {
+    size_t length = 0;
+    size_t limit = std::min(a.size(), b.size());
+    while(length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+uint64_t KeyHead(span<const uint8_t> key) {
+    uint64_t head = 0;
+    for(size_t i = 0; i < sizeof(uint64_t); i++) {
+        head = (head << 8) | (i < key.size() ? key[i] : 0);
+    }
+    return head;
+}
+
+NodeView::NodeView(PageHandle page) : NodeView(page.get()) {
+    this->page = std::move(page);
+}
+
+PageHandle NodeView::Page() const {
+    return page;
+}
+
+NodeView::NodeView(const uint8_t* data) {
+    this->data = data;
+    key_count = (data[1] << 8) + data[2];
+    prefix_length = (data[3] << 8) + data[4];
+    offsets_start = 5 + prefix_length;
+    keys_start = offsets_start + (key_count + 1) * 4;
+    if(Type() == BNodeType::NODE) {
+        keys_start += key_count * sizeof(uint64_t);
+    }
+}
+
+BNodeType NodeView::Type() const {
+    return static_cast<BNodeType>(data[0]);
+}
+
+uint16_t NodeView::KeyCount() const {
+    return key_count;
+}
+
+uint16_t NodeView::KeyOffset(uint16_t index) const {
+    return (data[offsets_start + index * 2] << 8) + data[offsets_start + index * 2 + 1];
+}
+
+uint16_t NodeView::ValueOffset(uint16_t index) const {
+    uint16_t values_offsets = offsets_start + (key_count + 1) * 2;
+    return (data[values_offsets + index * 2] << 8) + data[values_offsets + index * 2 + 1];
+}
+
+span<const uint8_t> NodeView::Prefix() const {
+    return {data + 5, prefix_length};
+}
+
+span<const uint8_t> NodeView::KeySuffix(uint16_t index) const {
+    uint16_t start = KeyOffset(index);
+    return {data + keys_start + start, static_cast<size_t>(KeyOffset(index + 1) - start)};
+}
+
+vector<uint8_t> NodeView::Key(uint16_t index) const {
+    auto suffix = KeySuffix(index);
+    vector<uint8_t> key;
+    key.reserve(prefix_length + suffix.size());
+    key.insert(key.end(), data + 5, data + 5 + prefix_length);
+    key.insert(key.end(), suffix.begin(), suffix.end());
+    return key;
+}
+
+span<const uint8_t> NodeView::Value(uint16_t index) const {
+    uint16_t start = ValueOffset(index);
+    return {data + keys_start + start, static_cast<size_t>(ValueOffset(index + 1) - start)};
+}
+
+uint64_t NodeView::Head(uint16_t index) const {
+    return FromCharPointer<uint64_t>(data + offsets_start + (key_count + 1) * 4 + index * sizeof(uint64_t));
+}
+
+uint64_t NodeView::Pointer(uint16_t index) const {
+    return FromCharPointer<uint64_t>(data + keys_start + ValueOffset(index));
+}
+
+int NodeView::ComparePrefix(span<const uint8_t> key) const {
+    size_t common = std::min<size_t>(key.size(), prefix_length);
+    if(common > 0) {
+        int result = memcmp(key.data(), data + 5, common);
+        if(result != 0) {
+            return result;
+        }
+    }
+    return key.size() < prefix_length ? -1 : 0;
+}
+
+uint16_t NodeView::Find(span<const uint8_t> key) const {
+    if(ComparePrefix(key) != 0) {
+        return key_count;
+    }
+    uint16_t index = LowerBound(key);
+    if(index < key_count && CompareKeys(KeySuffix(index), key.subspan(prefix_length)) == 0) {
+        return index;
+    }
+    return key_count;
+}
+
+uint16_t NodeView::LowerBound(span<const uint8_t> key) const {
+    int relation = ComparePrefix(key);
+    if(relation != 0) {
+        return relation < 0 ? 0 : key_count;
+    }
+    auto suffix = key.subspan(prefix_length);
+    uint16_t low = 0, high = key_count;
+    while(low < high) {
+        uint16_t middle = low + (high - low) / 2;
+        if(CompareKeys(KeySuffix(middle), suffix) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+uint16_t NodeView::FindChild(span<const uint8_t> key) const {
+    if(key_count == 0) {
+        return 0;
+    }
+    int relation = ComparePrefix(key);
+    if(relation != 0) {
+        return relation < 0 ? 0 : key_count - 1;
+    }
+    auto suffix = key.subspan(prefix_length);
+    if(Type() == BNodeType::LEAF) {
+        uint16_t index = LowerBound(key);
+        if(index < key_count && CompareKeys(KeySuffix(index), suffix) == 0) {
+            return index;
+        }
+        return index == 0 ? 0 : index - 1;
+    }
+
+    // Branch-light search for the last head <= the suffix's head
+    uint64_t head = KeyHead(suffix);
+    uint16_t base = 0, length = key_count;
+    while(length > 1) {
+        uint16_t half = length / 2;
+        base = Head(base + half) <= head ? base + half : base;
+        length -= half;
+    }
+    // Keys sharing the head sit right before it, only those need the full suffix
+    while(base > 0 && Head(base) == head && CompareKeys(KeySuffix(base), suffix) > 0) {
+        base--;
+    }
+    return base;
+}
@@ -0,0 +1,62 @@
+#ifndef NODEVIEW
+#define NODEVIEW
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "bplusnode.hpp"
+#include "pageio.hpp"
+
+using std::span;
+using std::vector;
+
+// Lexicographic byte comparison, same ordering as the std::map keys in BPlusNode
+int CompareKeys(span<const uint8_t> a, span<const uint8_t> b);
+size_t CommonPrefixLength(span<const uint8_t> a, span<const uint8_t> b);
+// First 8 bytes of key as a big-endian integer, zero padded
+// head(a) < head(b) implies a < b, only equal heads need a full comparison
+uint64_t KeyHead(span<const uint8_t> key);
+
+// Read-only view over a serialized node page, reads keys and values in place without decoding
+class NodeView {
+    public:
+        NodeView(const uint8_t* data);
+        // Keeps the page alive for as long as the view, and the spans it returns, are in use
+        NodeView(PageHandle page);
+        PageHandle Page() const;
+
+        BNodeType Type() const;
+        uint16_t KeyCount() const;
+
+        // Keys are stored as a prefix shared by the whole node plus a suffix per key
+        span<const uint8_t> Prefix() const;
+        span<const uint8_t> KeySuffix(uint16_t index) const;
+        vector<uint8_t> Key(uint16_t index) const;
+        span<const uint8_t> Value(uint16_t index) const;
+        uint64_t Pointer(uint16_t index) const;
+
+        // Index of key, KeyCount() if not present
+        uint16_t Find(span<const uint8_t> key) const;
+        // Index of the first key >= key, KeyCount() if all keys are smaller
+        uint16_t LowerBound(span<const uint8_t> key) const;
+        // Index of the last key <= key, the child a search for key descends into
+        uint16_t FindChild(span<const uint8_t> key) const;
+
+    private:
+        uint16_t KeyOffset(uint16_t index) const;
+        uint16_t ValueOffset(uint16_t index) const;
+        uint64_t Head(uint16_t index) const;
+        // Negative if key sorts before every key in the node, positive if after, 0 if it starts with the prefix
+        int ComparePrefix(span<const uint8_t> key) const;
+
+        // type | key_count | prefix_len | prefix | key_offsets    | value_offsets  | key_heads (nodes only) | key suffixes | pointers/values |
+        // 1B   | 2B        | 2B         | nB     | key_count * 2B | key_count * 2B | key_count * 8B         | nB           | nB              |
+        PageHandle page;
+        const uint8_t* data;
+        uint16_t key_count;
+        uint16_t prefix_length;
+        uint16_t offsets_start;
+        uint16_t keys_start;
+};
+
+#endif
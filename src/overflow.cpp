@@ -0,0 +1,88 @@
+#include "overflow.hpp"
+#include <algorithm>
+#include <cstdint>
+#include "bitutils.hpp"
+#include "bplusnode.hpp"
+#include "diskmanager.hpp"
+
+vector<uint8_t> InlineValue(span<const uint8_t> value) {
+    if(value.empty() || value[0] != OVERFLOW_TAG) {
+        return vector<uint8_t>(value.begin(), value.end());
+    }
+    vector<uint8_t> stored{OVERFLOW_TAG, 0};
+    stored.insert(stored.end(), value.begin(), value.end());
+    return stored;
+}
+
+vector<uint8_t> OverflowValue(OverflowReference reference) {
+    vector<uint8_t> stored{OVERFLOW_TAG, 1};
+    for(auto c : ToCharVector(reference.first_page)) {
+        stored.push_back(c);
+    }
+    for(auto c : ToCharVector(reference.length)) {
+        stored.push_back(c);
+    }
+    return stored;
+}
+
+bool IsOverflowValue(span<const uint8_t> stored) {
+    return stored.size() == OVERFLOW_REFERENCE_BYTES && stored[0] == OVERFLOW_TAG && stored[1] == 1;
+}
+
+OverflowReference ParseOverflowValue(span<const uint8_t> stored) {
+    return {FromCharPointer<uint64_t>(stored.data() + 2), FromCharPointer<uint64_t>(stored.data() + 10)};
+}
+
+void StreamValue(DiskManager& manager, span<const uint8_t> stored, std::function<void(span<const uint8_t>)> callback) {
+    if(stored.empty() || stored[0] != OVERFLOW_TAG) {
+        callback(stored);
+        return;
+    }
+    if(!IsOverflowValue(stored)) {
+        callback(stored.subspan(2));
+        return;
+    }
+    OverflowReference reference = ParseOverflowValue(stored);
+    uint64_t page = reference.first_page;
+    uint64_t remaining = reference.length;
+    while(page != 0 && remaining > 0) {
+        PageHandle data = manager.GetPage(page);
+        uint64_t length = std::min<uint64_t>(remaining, OverflowPageData(manager));
+        page = FromCharPointer<uint64_t>(data.get());
+        if(page != 0) {
+            manager.Prefetch(page);
+        }
+        callback(span<const uint8_t>(data.get() + sizeof(uint64_t), length));
+        remaining -= length;
+    }
+}
+
+span<const uint8_t> ResolveValue(DiskManager& manager, span<const uint8_t> stored, vector<uint8_t>& buffer) {
+    if(stored.empty() || stored[0] != OVERFLOW_TAG) {
+        return stored;
+    }
+    if(!IsOverflowValue(stored)) {
+        return stored.subspan(2);
+    }
+    buffer.clear();
+    buffer.reserve(ParseOverflowValue(stored).length);
+    StreamValue(manager, stored, [&](span<const uint8_t> chunk) {
+        buffer.insert(buffer.end(), chunk.begin(), chunk.end());
+    });
+    return buffer;
+}
+
+uint64_t OverflowPageData(DiskManager& manager) {
+    return manager.PageSize() - sizeof(uint64_t);
+}
+
+vector<uint64_t> OverflowPages(DiskManager& manager, OverflowReference reference) {
+    vector<uint64_t> pages;
+    uint64_t page = reference.first_page;
+    uint64_t page_data = OverflowPageData(manager);
+    for(uint64_t n = 0; page != 0 && n * page_data < reference.length; n++) {
+        pages.push_back(page);
+        page = FromCharPointer<uint64_t>(manager.GetPage(page).get());
+    }
+    return pages;
+}
@@ -0,0 +1,51 @@
+#ifndef OVERFLOW
+#define OVERFLOW
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+#include "bplusnode.hpp"
+
+using std::span;
+using std::vector;
+
+class DiskManager;
+
+/*
+    Leaf values as stored
+    | value                           | first byte is not OVERFLOW_TAG, stored as is
+    | OVERFLOW_TAG | 0 | value        | inline value starting with OVERFLOW_TAG
+    | OVERFLOW_TAG | 1 | first page | length | value in overflow pages
+                         8B           8B
+
+    Overflow page
+    | next page | data                 |
+    | 8B        | page - 8B, 0 at end  |
+*/
+#define OVERFLOW_TAG 0xFF
+#define OVERFLOW_REFERENCE_BYTES 18
+// Values longer than this go to overflow pages
+#define DEFAULT_OVERFLOW_THRESHOLD 1024
+
+struct OverflowReference {
+    uint64_t first_page;
+    uint64_t length;
+};
+
+// Stored form of a value kept in the leaf
+vector<uint8_t> InlineValue(span<const uint8_t> value);
+vector<uint8_t> OverflowValue(OverflowReference reference);
+bool IsOverflowValue(span<const uint8_t> stored);
+OverflowReference ParseOverflowValue(span<const uint8_t> stored);
+
+// Value bytes of a stored value, in place for inline values or read into buffer from the overflow pages
+span<const uint8_t> ResolveValue(DiskManager& manager, span<const uint8_t> stored, vector<uint8_t>& buffer);
+// Hands the value to callback a page at a time without assembling it
+void StreamValue(DiskManager& manager, span<const uint8_t> stored, std::function<void(span<const uint8_t>)> callback);
+// Value bytes an overflow page of the file holds
+uint64_t OverflowPageData(DiskManager& manager);
+// Pages holding an overflow value in chain order
+vector<uint64_t> OverflowPages(DiskManager& manager, OverflowReference reference);
+
+#endif
@@ -0,0 +1,117 @@
+#include "pagecache.hpp"
+#include <cstdint>
+#include <utility>
+
+PageCache::PageCache(uint64_t capacity_bytes) {
+    this->capacity_bytes = capacity_bytes;
+    used_bytes = 0;
+    clock_hand = 0;
+    hits = 0;
+    misses = 0;
+}
+
+// Serialized size plus a rough per entry overhead of the maps and vectors
+uint64_t PageCache::EstimateBytes(const BPlusNode& node) {
+    return sizeof(Entry) + node.GetBytes() + (node.value_map.size() + node.pointer_map.size()) * 96;
+}
+
+std::shared_ptr<const BPlusNode> PageCache::Get(uint64_t pointer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto slot = slot_index.find(pointer);
+    if(slot == slot_index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    Entry& entry = entries[slot->second];
+    entry.referenced = true;
+    return entry.node;
+}
+
+bool PageCache::Take(uint64_t pointer, BPlusNode& node) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto slot = slot_index.find(pointer);
+    if(slot == slot_index.end()) {
+        misses++;
+        return false;
+    }
+    hits++;
+    // A count of 1 can not grow while the lock is held, so no reader sees the move
+    std::shared_ptr<BPlusNode>& cached = entries[slot->second].node;
+    if(cached.use_count() == 1) {
+        node = std::move(*cached);
+    }
+    else {
+        node = *cached;
+    }
+    EraseLocked(pointer);
+    return true;
+}
+
+void PageCache::Put(uint64_t pointer, std::shared_ptr<BPlusNode> node) {
+    uint64_t bytes = EstimateBytes(*node);
+    if(bytes > capacity_bytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    EraseLocked(pointer);
+    while(used_bytes + bytes > capacity_bytes) {
+        EvictOne();
+    }
+
+    size_t slot;
+    if(free_slots.empty()) {
+        slot = entries.size();
+        entries.push_back({pointer, bytes, false, true, std::move(node)});
+    }
+    else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        entries[slot] = {pointer, bytes, false, true, std::move(node)};
+    }
+    slot_index[pointer] = slot;
+    used_bytes += bytes;
+}
+
+void PageCache::Erase(uint64_t pointer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    EraseLocked(pointer);
+}
+
+void PageCache::EraseLocked(uint64_t pointer) {
+    auto slot = slot_index.find(pointer);
+    if(slot == slot_index.end()) {
+        return;
+    }
+    Entry& entry = entries[slot->second];
+    used_bytes -= entry.bytes;
+    entry.used = false;
+    entry.node.reset(); // readers still holding the node keep it
+    free_slots.push_back(slot->second);
+    slot_index.erase(slot);
+}
+
+void PageCache::EvictOne() {
+    // Give referenced entries a second chance, evict the first unreferenced one
+    while(true) {
+        if(clock_hand >= entries.size()) {
+            clock_hand = 0;
+        }
+        Entry& entry = entries[clock_hand];
+        clock_hand++;
+        if(!entry.used) {
+            continue;
+        }
+        if(entry.referenced) {
+            entry.referenced = false;
+            continue;
+        }
+        EraseLocked(entry.pointer);
+        return;
+    }
+}
+
+CacheStats PageCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {hits, misses, slot_index.size(), used_bytes};
+}
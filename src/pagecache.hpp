@@ -0,0 +1,65 @@
+#ifndef PAGECACHE
+#define PAGECACHE
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "bplusnode.hpp"
+
+using std::vector;
+using std::unordered_map;
+
+#define DEFAULT_CACHE_BYTES (16 * 1024 * 1024)
+
+struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t entries;
+    uint64_t bytes;
+};
+
+// Decoded node cache keyed by page offset with CLOCK eviction
+// Pages are never modified while live (copy-on-write), so entries only go stale when their page is recycled
+// Thread safe, shared by the writers of every tree in the file
+class PageCache {
+    public:
+        PageCache(uint64_t capacity_bytes);
+
+        // Shared with the cache rather than copied, nullptr on a miss
+        std::shared_ptr<const BPlusNode> Get(uint64_t pointer);
+        // Moves the node out and drops its entry, for nodes about to be replaced, copied if a reader still holds it
+        bool Take(uint64_t pointer, BPlusNode& node);
+        void Put(uint64_t pointer, std::shared_ptr<BPlusNode> node);
+        void Erase(uint64_t pointer);
+
+        CacheStats GetStats();
+
+    private:
+        struct Entry {
+            uint64_t pointer;
+            uint64_t bytes;
+            bool referenced;
+            bool used;
+            std::shared_ptr<BPlusNode> node;
+        };
+
+        void EraseLocked(uint64_t pointer);
+        void EvictOne();
+        static uint64_t EstimateBytes(const BPlusNode& node);
+
+        vector<Entry> entries;
+        vector<size_t> free_slots;
+        unordered_map<uint64_t, size_t> slot_index;
+        size_t clock_hand;
+        std::mutex mutex;
+
+        uint64_t capacity_bytes;
+        uint64_t used_bytes;
+        uint64_t hits;
+        uint64_t misses;
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "pageio.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <ostream>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+bool IsValidPageSize(uint64_t page_size) {
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+std::unique_ptr<PageIO> OpenPageIO(const PageIOOptions& options, std::string filename, int file_descriptor, uint64_t page_count, uint64_t page_size) {
+    switch(options.type) {
+        case PageIOType::PREAD:
+            return std::make_unique<PreadPageIO>(filename, file_descriptor, page_size, false);
+        case PageIOType::PREAD_DIRECT:
+            return std::make_unique<PreadPageIO>(filename, file_descriptor, page_size, true);
+        default:
+            return std::make_unique<MmapPageIO>(file_descriptor, page_count, page_size, options);
+    }
+}
+
+// Mmap
+
+MmapPageIO::MmapPageIO(int file_descriptor, uint64_t page_count, uint64_t page_size, const PageIOOptions& options) {
+    this->file_descriptor = file_descriptor;
+    this->page_size = page_size;
+    populate = options.populate;
+    huge_pages = options.huge_pages;
+    mapped_bytes = 0;
+    reserved_bytes = std::max<uint64_t>(options.reserve_bytes, page_size * page_count);
+    mapping = Reserve(reserved_bytes);
+    MapFile(mapping, 0, page_size * page_count);
+}
+
+MmapPageIO::~MmapPageIO() {
+    munmap(mapping, reserved_bytes);
+    for(auto& [base, bytes] : old_reservations) {
+        munmap(base, bytes);
+    }
+}
+
+// Inaccessible and not backed by memory until the file is mapped over it
+uint8_t* MmapPageIO::Reserve(uint64_t bytes) {
+    void* base = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) {
+        std::cerr << "Failed to reserve " << bytes << " bytes of address space" << std::endl;
+        return nullptr;
+    }
+    return static_cast<uint8_t*>(base);
+}
+
+// Maps [start, end) of the file at the same offset in the reservation, pages already mapped are left alone
+void MmapPageIO::MapFile(uint8_t* base, uint64_t start, uint64_t end) {
+    if(end <= start) {
+        return;
+    }
+    int flags = MAP_SHARED | MAP_FIXED;
+    if(populate) {
+        flags |= MAP_POPULATE;
+    }
+    if(mmap(base + start, end - start, PROT_READ | PROT_WRITE, flags, file_descriptor, start) == MAP_FAILED) {
+        std::cerr << "Failed to map file range " << start << " to " << end << std::endl;
+        return;
+    }
+    if(huge_pages) {
+        madvise(base + start, end - start, MADV_HUGEPAGE);
+    }
+}
+
+// Aliases the mapping without owning it, copying the handle costs no reference counting
+PageHandle MmapPageIO::ReadPage(uint64_t pointer) {
+    return PageHandle(PageHandle(), mapping + pointer);
+}
+
+void MmapPageIO::WritePage(uint64_t pointer, const vector<uint8_t>& data) {
+    if(data.size() > page_size) {
+        std::cerr << "Page " << pointer << " can not hold " << data.size() << " bytes" << std::endl;
+        return;
+    }
+    uint8_t* page = mapping + pointer;
+    std::copy(data.begin(), data.end(), page);
+    std::fill(page + data.size(), page + page_size, 0);
+}
+
+void MmapPageIO::Sync(uint64_t start, uint64_t length) {
+    msync(mapping + start, length, MS_SYNC);
+}
+
+void MmapPageIO::Prefetch(uint64_t pointer, uint64_t n_pages) {
+    madvise(mapping + pointer, n_pages * page_size, MADV_WILLNEED);
+}
+
+// The new tail is mapped in place, so pointers into the mapping stay valid and nothing is unmapped
+// Past the reservation the whole file moves to a new one twice the size, the old one is kept for readers
+void MmapPageIO::Grow(uint64_t n_pages) {
+    uint64_t new_bytes = n_pages * page_size;
+    ftruncate(file_descriptor, new_bytes);
+    if(new_bytes <= reserved_bytes) {
+        MapFile(mapping, mapped_bytes, new_bytes);
+    }
+    else {
+        uint64_t bytes = std::max(reserved_bytes * 2, new_bytes);
+        uint8_t* base = Reserve(bytes);
+        MapFile(base, 0, new_bytes);
+        old_reservations.push_back({mapping, reserved_bytes});
+        reserved_bytes = bytes;
+        mapping = base;
+    }
+    mapped_bytes = new_bytes;
+}
+
+// The cut off range goes back to reserved address space, so a stray read faults instead of reading past the file
+void MmapPageIO::Shrink(uint64_t n_pages) {
+    uint64_t new_bytes = n_pages * page_size;
+    if(new_bytes >= mapped_bytes) {
+        return;
+    }
+    if(mmap(mapping + new_bytes, mapped_bytes - new_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        std::cerr << "Failed to unmap file range " << new_bytes << " to " << mapped_bytes << std::endl;
+        return;
+    }
+    ftruncate(file_descriptor, new_bytes);
+    mapped_bytes = new_bytes;
+}
+
+uint8_t* MmapPageIO::ResidentPage(uint64_t pointer) {
+    return mapping + pointer;
+}
+
+void MmapPageIO::SyncResidentPage(uint64_t pointer) {
+    msync(mapping + pointer, page_size, MS_SYNC);
+}
+
+// Pread
+
+PreadPageIO::PreadPageIO(std::string filename, int file_descriptor, uint64_t page_size, bool direct, uint64_t buffer_pages) {
+    this->file_descriptor = file_descriptor;
+    this->page_size = page_size;
+    this->direct = direct;
+    this->buffer_pages = buffer_pages;
+    if(direct) {
+        this->file_descriptor = open(filename.c_str(), O_RDWR | O_DIRECT);
+        if(this->file_descriptor < 0) {
+            std::cerr << "O_DIRECT not supported for " << filename << ", using the page cache" << std::endl;
+            this->file_descriptor = file_descriptor;
+            this->direct = false;
+        }
+    }
+}
+
+PreadPageIO::~PreadPageIO() {
+    if(direct) {
+        close(file_descriptor);
+    }
+}
+
+std::shared_ptr<uint8_t> PreadPageIO::NewBuffer() {
+    uint8_t* buffer = static_cast<uint8_t*>(std::aligned_alloc(page_size, page_size));
+    std::memset(buffer, 0, page_size);
+    return std::shared_ptr<uint8_t>(buffer, std::free);
+}
+
+// Past the end of the file reads as zeroes
+void PreadPageIO::ReadInto(uint64_t pointer, uint8_t* buffer) {
+    if(pread(file_descriptor, buffer, page_size, pointer) < 0) {
+        std::cerr << "Failed to read page " << pointer << std::endl;
+    }
+}
+
+PageHandle PreadPageIO::ReadPage(uint64_t pointer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto buffer = buffers.find(pointer);
+        if(buffer != buffers.end()) {
+            return buffer->second;
+        }
+    }
+    auto buffer = NewBuffer();
+    ReadInto(pointer, buffer.get());
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = buffers.try_emplace(pointer, buffer);
+    PageHandle page = inserted.first->second;
+    if(inserted.second) {
+        EvictCleanLocked();
+    }
+    return page;
+}
+
+// Readers holding the old buffer keep it, new reads get the written one
+void PreadPageIO::WritePage(uint64_t pointer, const vector<uint8_t>& data) {
+    if(data.size() > page_size) {
+        std::cerr << "Page " << pointer << " can not hold " << data.size() << " bytes" << std::endl;
+        return;
+    }
+    auto buffer = NewBuffer();
+    std::copy(data.begin(), data.end(), buffer.get());
+    std::lock_guard<std::mutex> lock(mutex);
+    buffers[pointer] = buffer;
+    dirty[pointer] = buffer;
+}
+
+// Dirty pages in the range go out as runs of adjacent pages, one pwritev each, then a single fdatasync
+void PreadPageIO::Sync(uint64_t start, uint64_t length) {
+    vector<std::pair<uint64_t, std::shared_ptr<uint8_t>>> pages;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto first = dirty.lower_bound(start);
+        auto last = dirty.lower_bound(start + length);
+        pages.assign(first, last);
+        dirty.erase(first, last);
+    }
+
+    size_t i = 0;
+    while(i < pages.size()) {
+        vector<iovec> run;
+        uint64_t run_start = pages[i].first;
+        while(i < pages.size() && run.size() < IOV_MAX && pages[i].first == run_start + run.size() * page_size) {
+            run.push_back({pages[i].second.get(), page_size});
+            i++;
+        }
+        if(pwritev(file_descriptor, run.data(), run.size(), run_start) < 0) {
+            std::cerr << "Failed to write pages at " << run_start << std::endl;
+        }
+    }
+    fdatasync(file_descriptor);
+    EvictClean();
+}
+
+void PreadPageIO::EvictClean() {
+    std::lock_guard<std::mutex> lock(mutex);
+    EvictCleanLocked();
+}
+
+// Done on every read that adds a buffer and on Sync, readers holding an evicted buffer keep it
+// Written buffers stay until synced, so the pool only goes over buffer_pages by the pages written since
+void PreadPageIO::EvictCleanLocked() {
+    if(buffers.size() <= buffer_pages || buffers.size() <= dirty.size()) {
+        return;
+    }
+    for(auto buffer = buffers.begin(); buffer != buffers.end() && buffers.size() > buffer_pages;) {
+        if(dirty.count(buffer->first) == 0) {
+            buffer = buffers.erase(buffer);
+        }
+        else {
+            buffer++;
+        }
+    }
+}
+
+// O_DIRECT reads skip the page cache, so there is nothing to warm up
+void PreadPageIO::Prefetch(uint64_t pointer, uint64_t n_pages) {
+    if(!direct) {
+        posix_fadvise(file_descriptor, pointer, n_pages * page_size, POSIX_FADV_WILLNEED);
+    }
+}
+
+void PreadPageIO::Grow(uint64_t n_pages) {
+    ftruncate(file_descriptor, n_pages * page_size);
+}
+
+// Buffered pages past the end are dropped with it, written ones included
+void PreadPageIO::Shrink(uint64_t n_pages) {
+    uint64_t new_bytes = n_pages * page_size;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::erase_if(buffers, [&](auto& buffer) { return buffer.first >= new_bytes; });
+        std::erase_if(resident, [&](auto& buffer) { return buffer.first >= new_bytes; });
+        dirty.erase(dirty.lower_bound(new_bytes), dirty.end());
+    }
+    ftruncate(file_descriptor, new_bytes);
+}
+
+uint8_t* PreadPageIO::ResidentPage(uint64_t pointer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto page = resident.find(pointer);
+    if(page != resident.end()) {
+        return page->second.get();
+    }
+    auto buffer = NewBuffer();
+    ReadInto(pointer, buffer.get());
+    resident[pointer] = buffer;
+    return buffer.get();
+}
+
+void PreadPageIO::SyncResidentPage(uint64_t pointer) {
+    uint8_t* buffer = ResidentPage(pointer);
+    if(pwrite(file_descriptor, buffer, page_size, pointer) < 0) {
+        std::cerr << "Failed to write page " << pointer << std::endl;
+    }
+    fdatasync(file_descriptor);
+}
@@ -0,0 +1,134 @@
+#ifndef PAGEIO
+#define PAGEIO
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+// Page size of a new file, a power of two in [MIN_PAGE_SIZE, MAX_PAGE_SIZE]
+// Node offsets are 16 bit, they count from the start of the keys so a 64K page still fits them
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+#define DEFAULT_BUFFER_PAGES 4096
+// Address space reserved up front for the mapping, the file grows into it without moving
+#define DEFAULT_MAPPING_RESERVE (uint64_t(1) << 36)
+
+enum PageIOType : uint8_t {
+    MMAP,
+    PREAD,
+    PREAD_DIRECT // O_DIRECT, bypasses the kernel page cache
+};
+
+// How the data file is accessed, converts from a PageIOType for the defaults
+struct PageIOOptions {
+    PageIOOptions(PageIOType type = PageIOType::MMAP) : type(type) {}
+
+    PageIOType type;
+    uint64_t page_size = DEFAULT_PAGE_SIZE; // for a new file, an existing one keeps the size it was created with
+    uint64_t growth_pages = 0; // pages added when the file is full, 0 doubles it
+    // Mmap only
+    uint64_t reserve_bytes = DEFAULT_MAPPING_RESERVE;
+    bool populate = false; // prefault the mapping instead of faulting pages in on first read
+    bool huge_pages = false; // ask for transparent huge pages over the mapping
+};
+
+// Read-only page contents, stays valid while the handle is held even if the page is written again
+typedef std::shared_ptr<const uint8_t> PageHandle;
+
+// Page level access to the data file, picked when the file is opened
+class PageIO {
+    public:
+        virtual ~PageIO() = default;
+
+        virtual PageHandle ReadPage(uint64_t pointer) = 0;
+        // Whole page, zero padded, durable after the next Sync over it
+        virtual void WritePage(uint64_t pointer, const vector<uint8_t>& data) = 0;
+        virtual void Sync(uint64_t start, uint64_t length) = 0;
+        // Hint that n_pages pages from pointer will be read soon
+        virtual void Prefetch(uint64_t pointer, uint64_t n_pages) = 0;
+        virtual void Grow(uint64_t n_pages) = 0;
+        // Cuts the file down to n_pages, nothing past it may be read or written afterwards
+        virtual void Shrink(uint64_t n_pages) = 0;
+
+        // Metadata and bitmap pages, updated in place and kept in memory
+        virtual uint8_t* ResidentPage(uint64_t pointer) = 0;
+        virtual void SyncResidentPage(uint64_t pointer) = 0;
+};
+
+bool IsValidPageSize(uint64_t page_size);
+std::unique_ptr<PageIO> OpenPageIO(const PageIOOptions& options, std::string filename, int file_descriptor, uint64_t page_count, uint64_t page_size);
+
+// Whole file mapped MAP_SHARED, reads are page faults and writes are copies into the mapping
+class MmapPageIO : public PageIO {
+    public:
+        MmapPageIO(int file_descriptor, uint64_t page_count, uint64_t page_size, const PageIOOptions& options);
+        ~MmapPageIO();
+
+        PageHandle ReadPage(uint64_t pointer) override;
+        void WritePage(uint64_t pointer, const vector<uint8_t>& data) override;
+        void Sync(uint64_t start, uint64_t length) override;
+        void Prefetch(uint64_t pointer, uint64_t n_pages) override;
+        void Grow(uint64_t n_pages) override;
+        void Shrink(uint64_t n_pages) override;
+
+        uint8_t* ResidentPage(uint64_t pointer) override;
+        void SyncResidentPage(uint64_t pointer) override;
+
+    private:
+        uint8_t* Reserve(uint64_t bytes);
+        void MapFile(uint8_t* base, uint64_t start, uint64_t end);
+
+        int file_descriptor;
+        uint64_t page_size;
+        bool populate;
+        bool huge_pages;
+        uint64_t mapped_bytes;
+        uint64_t reserved_bytes;
+        // Only replaced when the file outgrows the reservation, old reservations stay valid for readers that loaded them
+        std::atomic<uint8_t*> mapping;
+        vector<std::pair<uint8_t*, uint64_t>> old_reservations;
+};
+
+// Pages read with pread into a buffer pool, written pages are held until Sync writes them in batches with pwritev
+class PreadPageIO : public PageIO {
+    public:
+        // With direct the file is opened again with O_DIRECT, buffers are page aligned for it
+        PreadPageIO(std::string filename, int file_descriptor, uint64_t page_size, bool direct, uint64_t buffer_pages = DEFAULT_BUFFER_PAGES);
+        ~PreadPageIO();
+
+        PageHandle ReadPage(uint64_t pointer) override;
+        void WritePage(uint64_t pointer, const vector<uint8_t>& data) override;
+        void Sync(uint64_t start, uint64_t length) override;
+        void Prefetch(uint64_t pointer, uint64_t n_pages) override;
+        void Grow(uint64_t n_pages) override;
+        void Shrink(uint64_t n_pages) override;
+
+        uint8_t* ResidentPage(uint64_t pointer) override;
+        void SyncResidentPage(uint64_t pointer) override;
+
+    private:
+        std::shared_ptr<uint8_t> NewBuffer();
+        void ReadInto(uint64_t pointer, uint8_t* buffer);
+        void EvictClean();
+        void EvictCleanLocked();
+
+        int file_descriptor;
+        uint64_t page_size;
+        bool direct;
+        uint64_t buffer_pages;
+
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::shared_ptr<uint8_t>> buffers;
+        std::map<uint64_t, std::shared_ptr<uint8_t>> dirty; // ordered to coalesce adjacent pages
+        std::unordered_map<uint64_t, std::shared_ptr<uint8_t>> resident;
+};
+
+#endif
@@ -11,7 +11,7 @@ Record::Record(DataType type, std::any value) {
     this->value = value;
 }
 
-Record::Record(uint8_t* serialized_data) {
+Record::Record(const uint8_t* serialized_data) {
     this->type = static_cast<DataType>(serialized_data[0]);
     switch(this->type) {
         case DataType::INTEGER:
@@ -1,3 +1,6 @@
+#ifndef RECORD
+#define RECORD
+
 #include <any>
 #include <cstdint>
 #include <vector>
@@ -12,9 +15,11 @@ enum DataType : uint8_t {
 class Record {
     public: 
         Record(DataType type, std::any value);
-        Record(uint8_t* serialzied_data);
+        Record(const uint8_t* serialzied_data);
         DataType type;
         std::any value;
         std::any Get();
         vector<uint8_t> Serialize();
 };
+
+#endif
@@ -0,0 +1,100 @@
+#include "row.hpp"
+#include <any>
+#include <cstdint>
+#include <string>
+#include "bitutils.hpp"
+
+vector<uint8_t> EncodeRow(const Table& table, const vector<std::any>& values) {
+    uint16_t bitmap_bytes = (values.size() + 7) / 8;
+    vector<uint8_t> nulls(bitmap_bytes, 0);
+    vector<uint8_t> fixed(table.fixed_columns * sizeof(uint64_t), 0);
+    vector<uint8_t> offsets;
+    vector<uint8_t> variable;
+    offsets.reserve(table.variable_columns * sizeof(uint16_t));
+
+    for(size_t i = 0; i < values.size(); i++) {
+        bool null = !values[i].has_value();
+        if(null) {
+            nulls[i / 8] |= 1 << (i % 8);
+        }
+        if(table.schema[i] == DataType::INTEGER) {
+            if(!null) {
+                auto value = ToCharVector(std::any_cast<uint64_t>(values[i]));
+                std::copy(value.begin(), value.end(), fixed.begin() + table.column_slots[i] * sizeof(uint64_t));
+            }
+            continue;
+        }
+        if(!null && table.schema[i] == DataType::STRING) {
+            auto& value = std::any_cast<const std::string&>(values[i]);
+            variable.insert(variable.end(), value.begin(), value.end());
+        }
+        auto end_offset = ToCharVector(static_cast<uint16_t>(variable.size()));
+        offsets.insert(offsets.end(), end_offset.begin(), end_offset.end());
+    }
+
+    vector<uint8_t> serialized{ROW_FORMAT_VERSION, (uint8_t)values.size()};
+    serialized.reserve(2 + nulls.size() + fixed.size() + offsets.size() + variable.size());
+    serialized.insert(serialized.end(), nulls.begin(), nulls.end());
+    serialized.insert(serialized.end(), fixed.begin(), fixed.end());
+    serialized.insert(serialized.end(), offsets.begin(), offsets.end());
+    serialized.insert(serialized.end(), variable.begin(), variable.end());
+    return serialized;
+}
+
+RowView::RowView(const Table* table, span<const uint8_t> data) {
+    this->table = table;
+    this->data = data;
+    fixed_start = 0;
+    offsets_start = 0;
+    variable_start = 0;
+    if(Valid()) {
+        fixed_start = 2 + (data[1] + 7) / 8;
+        offsets_start = fixed_start + table->fixed_columns * sizeof(uint64_t);
+        variable_start = offsets_start + table->variable_columns * sizeof(uint16_t);
+    }
+}
+
+bool RowView::Valid() const {
+    return table != nullptr && data.size() >= 2 && data[0] == ROW_FORMAT_VERSION && data[1] == table->schema.size();
+}
+
+bool RowView::IsNull(uint16_t column) const {
+    return (data[2 + column / 8] >> (column % 8)) & 1;
+}
+
+uint64_t RowView::GetInt(uint16_t column) const {
+    return FromCharPointer<uint64_t>(data.data() + fixed_start + table->column_slots[column] * sizeof(uint64_t));
+}
+
+std::string_view RowView::GetString(uint16_t column) const {
+    uint16_t slot = table->column_slots[column];
+    uint16_t start = slot == 0 ? 0 : FromCharPointer<uint16_t>(data.data() + offsets_start + (slot - 1) * sizeof(uint16_t));
+    uint16_t end = FromCharPointer<uint16_t>(data.data() + offsets_start + slot * sizeof(uint16_t));
+    return std::string_view(reinterpret_cast<const char*>(data.data()) + variable_start + start, end - start);
+}
+
+vector<std::any> RowView::ToValues() const {
+    vector<std::any> values;
+    if(!Valid()) {
+        return values;
+    }
+    values.reserve(table->schema.size());
+    for(uint16_t i = 0; i < table->schema.size(); i++) {
+        if(IsNull(i)) {
+            values.push_back(std::any());
+            continue;
+        }
+        switch(table->schema[i]) {
+            case DataType::INTEGER:
+                values.push_back(GetInt(i));
+            break;
+            case DataType::STRING:
+                values.push_back(std::string(GetString(i)));
+            break;
+            default:
+                values.push_back(std::any());
+            break;
+        }
+    }
+    return values;
+}
@@ -0,0 +1,45 @@
+#ifndef ROW
+#define ROW
+
+#include <any>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "table.hpp"
+
+using std::span;
+using std::vector;
+
+#define ROW_FORMAT_VERSION 1
+
+/*
+    | version | n_columns | null bitmap      | fixed slots            | variable end offsets      | variable data |
+    | 1B      | 1B        | ceil(n / 8) B    | fixed_columns * 8B     | variable_columns * 2B     | nB            |
+
+    INTEGER columns take a fixed slot, everything else is variable length
+*/
+vector<uint8_t> EncodeRow(const Table& table, const vector<std::any>& values);
+
+// Typed column access straight from the encoded row, no decoding of the other columns
+class RowView {
+    public:
+        RowView(const Table* table, span<const uint8_t> data);
+
+        bool Valid() const;
+        bool IsNull(uint16_t column) const;
+        uint64_t GetInt(uint16_t column) const;
+        std::string_view GetString(uint16_t column) const;
+
+        // Boxed values in schema order, empty std::any for NULL
+        vector<std::any> ToValues() const;
+
+    private:
+        const Table* table;
+        span<const uint8_t> data;
+        uint16_t fixed_start;
+        uint16_t offsets_start;
+        uint16_t variable_start;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "snapshot.hpp"
+#include <utility>
+
+Snapshot::Snapshot(DiskManager& manager, uint16_t root_slot) {
+    this->manager = &manager;
+    generation = manager.PinRoot(root_slot, root);
+}
+
+Snapshot::Snapshot(Snapshot&& other) {
+    manager = other.manager;
+    root = other.root;
+    generation = other.generation;
+    held_pages = std::move(other.held_pages);
+    held_values = std::move(other.held_values);
+    other.manager = nullptr;
+}
+
+Snapshot::~Snapshot() {
+    if(manager != nullptr) {
+        manager->UnpinRoot(generation);
+    }
+}
+
+vector<uint8_t> Snapshot::Get(span<const uint8_t> key) {
+    vector<uint8_t> value;
+    Get(key, value);
+    return value;
+}
+
+void Snapshot::Get(span<const uint8_t> key, vector<uint8_t>& value) {
+    NodeView leaf = FindLeaf(*manager, root, key);
+    auto stored = LeafValue(leaf, key);
+    if(IsOverflowValue(stored)) {
+        ResolveValue(*manager, stored, value);
+        return;
+    }
+    auto resolved = ResolveValue(*manager, stored, value);
+    value.assign(resolved.begin(), resolved.end());
+}
+
+span<const uint8_t> Snapshot::GetView(span<const uint8_t> key) {
+    NodeView leaf = FindLeaf(*manager, root, key);
+    auto value = LeafValue(leaf, key);
+    if(IsOverflowValue(value)) {
+        held_values.emplace_back();
+        return ResolveValue(*manager, value, held_values.back());
+    }
+    if(!value.empty() && leaf.Page() != nullptr) {
+        held_pages.push_back(leaf.Page());
+    }
+    vector<uint8_t> unused;
+    return ResolveValue(*manager, value, unused);
+}
+
+vector<std::optional<vector<uint8_t>>> Snapshot::MultiGet(span<const vector<uint8_t>> keys, uint16_t threads, bool prefetch) {
+    return MultiLookup(*manager, root, keys, threads, prefetch);
+}
+
+Cursor Snapshot::NewCursor() {
+    return Cursor(*manager, root);
+}
+
+void Snapshot::Scan(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback) {
+    ScanRange(*manager, root, lo, hi, callback);
+}
+
+void Snapshot::ScanLeaves(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(const NodeView&, uint16_t, uint16_t)> callback) {
+    ::ScanLeaves(*manager, root, lo, hi, callback);
+}
+
+vector<vector<uint8_t>> Snapshot::SplitKeyRange(span<const uint8_t> lo, span<const uint8_t> hi, uint16_t parts) {
+    return ::SplitKeyRange(*manager, root, lo, hi, parts);
+}
+
+DiskManager& Snapshot::Manager() {
+    return *manager;
+}
+
+uint64_t Snapshot::Generation() {
+    return generation;
+}
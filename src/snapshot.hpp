@@ -0,0 +1,53 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <span>
+#include <vector>
+#include "cursor.hpp"
+#include "diskmanager.hpp"
+
+using std::span;
+using std::vector;
+
+// Read-only view of the tree as of the last committed root
+// Needs no locks to read while a writer commits, the pages it can reach are not reused until it is destroyed
+// Used by one thread at a time
+class Snapshot {
+    public:
+        Snapshot(DiskManager& manager, uint16_t root_slot);
+        ~Snapshot();
+        Snapshot(Snapshot&& other);
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        vector<uint8_t> Get(span<const uint8_t> key);
+        // Value copied into value reusing its capacity, empty if key is missing
+        void Get(span<const uint8_t> key, vector<uint8_t>& value);
+        // Value in place in the mapped page, valid for the lifetime of the snapshot
+        span<const uint8_t> GetView(span<const uint8_t> key);
+        // Values in the order of keys, nullopt for missing keys, see MultiLookup
+        vector<std::optional<vector<uint8_t>>> MultiGet(span<const vector<uint8_t>> keys, uint16_t threads = 1, bool prefetch = true);
+
+        Cursor NewCursor();
+        void Scan(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(span<const uint8_t>, span<const uint8_t>)> callback);
+        // See ScanLeaves and SplitKeyRange, unlike the rest these may be called from several threads at once
+        void ScanLeaves(span<const uint8_t> lo, span<const uint8_t> hi, std::function<bool(const NodeView&, uint16_t, uint16_t)> callback);
+        vector<vector<uint8_t>> SplitKeyRange(span<const uint8_t> lo, span<const uint8_t> hi, uint16_t parts);
+        DiskManager& Manager();
+
+        uint64_t Generation();
+
+    private:
+        DiskManager* manager;
+        uint64_t root;
+        uint64_t generation;
+        // Pages GetView returned values from, kept for backends that read into buffers
+        vector<PageHandle> held_pages;
+        // Overflow values GetView returned
+        std::deque<vector<uint8_t>> held_values;
+};
+
+#endif
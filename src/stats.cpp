@@ -0,0 +1,54 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+void AddTreeStats(EngineStats& into, const EngineStats& from) {
+    into.node_splits += from.node_splits;
+    into.node_merges += from.node_merges;
+    into.node_borrows += from.node_borrows;
+    for(auto [to, add] : {std::make_pair(&into.insert, &from.insert), std::make_pair(&into.get, &from.get), std::make_pair(&into.remove, &from.remove)}) {
+        to->count += add->count;
+        to->timed += add->timed;
+        to->total_nanos += add->total_nanos;
+        to->max_nanos = std::max(to->max_nanos, add->max_nanos);
+    }
+}
+
+// Threads are spread over the stripes in the order they first count something
+size_t Counter::Stripe() {
+    static std::atomic<size_t> next_stripe{0};
+    thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % COUNTER_STRIPES;
+    return stripe;
+}
+
+uint64_t Counter::Read() {
+    uint64_t sum = 0;
+    for(auto& slot : stripes) {
+        sum += slot.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+OperationStats OperationCounter::Read() {
+    return {
+        count.load(std::memory_order_relaxed),
+        timed.load(std::memory_order_relaxed),
+        total_nanos.load(std::memory_order_relaxed),
+        max_nanos.load(std::memory_order_relaxed)
+    };
+}
+
+OperationTimer::~OperationTimer() {
+    if(!sampled) {
+        return;
+    }
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    counter.timed.fetch_add(1, std::memory_order_relaxed);
+    counter.total_nanos.fetch_add(nanos, std::memory_order_relaxed);
+    uint64_t max = counter.max_nanos.load(std::memory_order_relaxed);
+    while(nanos > max && !counter.max_nanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef STATS
+#define STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "pagecache.hpp"
+
+#define COUNTER_STRIPES 16
+
+struct OperationStats {
+    uint64_t count;
+    uint64_t timed; // calls sampled for timing
+    uint64_t total_nanos; // over the timed calls
+    uint64_t max_nanos;
+};
+
+struct EngineStats {
+    // Shared by every tree in the file
+    uint64_t pages_read;
+    uint64_t nodes_decoded;
+    uint64_t pages_written;
+    uint64_t syncs;
+    uint64_t bytes_synced; // length of the synced ranges, only the dirty pages in them are written
+    uint64_t pages_freed;
+    uint64_t file_grows;
+    uint64_t file_pages;
+    uint64_t free_pages;
+    CacheStats cache;
+
+    // Summed over trees
+    uint64_t node_splits;
+    uint64_t node_merges;
+    uint64_t node_borrows; // underfull nodes refilled from a sibling
+    OperationStats insert; // Insert and Update
+    OperationStats get;
+    OperationStats remove;
+};
+
+// Adds the per tree counts of from to into
+void AddTreeStats(EngineStats& into, const EngineStats& from);
+
+// Relaxed counter striped over cache lines, threads add to their own stripe so readers do not contend
+class Counter {
+    public:
+        void Add(uint64_t n = 1) {
+            stripes[Stripe()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+        uint64_t Read();
+
+    private:
+        static size_t Stripe();
+
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> value{0};
+        };
+        Slot stripes[COUNTER_STRIPES];
+};
+
+// Call count of one operation, with the time of every sample_every-th call
+class OperationCounter {
+    public:
+        OperationStats Read();
+
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> timed{0};
+        std::atomic<uint64_t> total_nanos{0};
+        std::atomic<uint64_t> max_nanos{0};
+};
+
+// Counts the operation for its scope and times it if it falls on the sample, 0 never times
+class OperationTimer {
+    public:
+        OperationTimer(OperationCounter& counter, uint32_t sample_every) : counter(counter) {
+            uint64_t n = counter.count.fetch_add(1, std::memory_order_relaxed);
+            sampled = sample_every != 0 && n % sample_every == 0;
+            if(sampled) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+        ~OperationTimer();
+
+    private:
+        OperationCounter& counter;
+        bool sampled;
+        std::chrono::steady_clock::time_point start;
+};
+
+#endif
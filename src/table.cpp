@@ -10,10 +10,12 @@ Table::Table(std::string table_name, uint32_t prefix, vector<DataType> column_sc
     this->prefix = prefix;
     this->schema = column_schema;
     this->column_names = column_names;
+    this->root_slot = 0;
+    ComputeRowLayout();
 }
 
-Table::Table(uint8_t* data) {
-    this->prefix = FromCharPointer<uint32_t>(data);
+Table::Table(std::span<const uint8_t> data) {
+    this->prefix = FromCharPointer<uint32_t>(data.data());
 
     for(int i = 0; i < data[4]; i++) { // Load name
         name += data[5 + i];
@@ -33,10 +35,29 @@ Table::Table(uint8_t* data) {
         current_name += data[current_name] + 1;
         this->column_names.push_back(col_name);
     }
+    this->root_slot = 0;
+    if(current_name + sizeof(uint16_t) <= data.size()) { // written before tables had their own trees otherwise
+        this->root_slot = FromCharPointer<uint16_t>(data.data() + current_name);
+    }
+    ComputeRowLayout();
+}
+
+void Table::ComputeRowLayout() {
+    column_slots.clear();
+    fixed_columns = 0;
+    variable_columns = 0;
+    for(auto type : schema) {
+        if(type == DataType::INTEGER) {
+            column_slots.push_back(fixed_columns++);
+        }
+        else {
+            column_slots.push_back(variable_columns++);
+        }
+    }
 }
 
 /*
-    | prefix | name | n_records | n * record_type | n * record_name |
+    | prefix | name | n_records | n * record_type | n * record_name | root_slot |
 
     name/record_name = | len(name) | name |
 */
@@ -60,6 +81,10 @@ vector<uint8_t> Table::SerializeTableSchema() {
             serialized.push_back(c);
         }
     }
+
+    for(auto c : ToCharVector(root_slot)) {
+        serialized.push_back(c);
+    }
     return serialized;
 }
 
@@ -68,6 +93,9 @@ bool Table::CheckSchema(vector<std::any> values) {
         return false;
     }
     for(int i = 0; i < this->schema.size(); i++) {
+        if(!values[i].has_value()) { // NULL
+            continue;
+        }
         switch (this->schema[i]) {
             case INTEGER:
                 if(values[i].type() != typeid(uint64_t)) {
@@ -1,6 +1,11 @@
+#ifndef TABLE
+#define TABLE
+
 #include <cstdint>
+#include <span>
 #include <vector>
 #include <string>
+#include "index.hpp"
 #include "record.hpp"
 
 using std::vector;
@@ -8,13 +13,27 @@ using std::vector;
 class Table {
     public:
         Table(std::string table_name, uint32_t prefix, vector<DataType> column_schema, vector<std::string> column_names);
-        Table(uint8_t* data);
+        Table(std::span<const uint8_t> data);
 
         uint32_t prefix;
         std::string name;
         vector<DataType> schema;
         vector<std::string> column_names;
+        // Metadata root slot of the table's own B+ tree, 0 if its rows are in the shared one
+        uint16_t root_slot;
+        // Loaded from their own catalog entries, not part of the serialized table
+        vector<Index> indexes;
+
+        // Row layout, index of each column among the fixed width or the variable length ones
+        vector<uint16_t> column_slots;
+        uint16_t fixed_columns;
+        uint16_t variable_columns;
 
         vector<uint8_t> SerializeTableSchema();
         bool CheckSchema(vector<std::any> values);
-};
\ No newline at end of file
+
+    private:
+        void ComputeRowLayout();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bplustree.hpp"
+
+using std::vector;
+
+// A single Compact() has to leave no free pages at the end of the file and must not grow it
+static bool CompactsInOnePass(std::string name, uint64_t page_size, uint64_t growth_pages, double merge_threshold) {
+    std::string filename = "compaction_test_data";
+    std::remove(filename.c_str());
+    PageIOOptions io_options;
+    io_options.page_size = page_size;
+    io_options.growth_pages = growth_pages;
+    bool ok = true;
+    {
+        BPlusTree tree(filename, 64, DEFAULT_CACHE_BYTES, io_options);
+        tree.SetMergeThreshold(merge_threshold);
+        std::mt19937 rng(5);
+        std::map<vector<uint8_t>, vector<uint8_t>> expected;
+        vector<vector<uint8_t>> keys;
+        tree.BeginTransaction();
+        for(int i = 0; i < 40000; i++) {
+            uint32_t k = rng();
+            vector<uint8_t> key{(uint8_t)(k >> 24), (uint8_t)(k >> 16), (uint8_t)(k >> 8), (uint8_t)k};
+            vector<uint8_t> value(rng() % 40 + 1, (uint8_t)i);
+            tree.Insert(key, value);
+            expected[key] = value;
+            keys.push_back(key);
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for(int i = 0; i < 30000; i++) {
+            tree.Delete(keys[i]);
+            expected.erase(keys[i]);
+        }
+        tree.CommitTransaction();
+
+        uint64_t pages_before = tree.Stats().file_pages;
+        if(tree.Compact() != COMPACTION_DONE) {
+            std::cerr << name << ": compaction did not finish" << std::endl;
+            ok = false;
+        }
+        uint64_t pages_after = tree.Stats().file_pages;
+        if(pages_after > pages_before) {
+            std::cerr << name << ": file grew from " << pages_before << " to " << pages_after << " pages" << std::endl;
+            ok = false;
+        }
+        // Whatever a second pass could still cut off was left behind free pages by the first
+        tree.Compact();
+        if(tree.Stats().file_pages < pages_after) {
+            std::cerr << name << ": a second compaction shrank the file from " << pages_after << " to " << tree.Stats().file_pages << " pages" << std::endl;
+            ok = false;
+        }
+        for(auto& key_value : expected) {
+            if(tree.Get(key_value.first) != key_value.second) {
+                std::cerr << name << ": wrong value after compaction" << std::endl;
+                ok = false;
+                break;
+            }
+        }
+        if(tree.VerifyFreeSpace() != 0) {
+            std::cerr << name << ": pages leaked by compaction" << std::endl;
+            ok = false;
+        }
+        std::cout << name << ": " << pages_before << " -> " << pages_after << " pages" << std::endl;
+    }
+    std::remove(filename.c_str());
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    ok &= CompactsInOnePass("4K pages", 4096, 0, DEFAULT_MERGE_THRESHOLD);
+    ok &= CompactsInOnePass("4K pages without merges", 4096, 0, 0);
+    ok &= CompactsInOnePass("16K pages growing by 100", 16384, 100, DEFAULT_MERGE_THRESHOLD);
+    std::cout << (ok ? "passed" : "failed") << std::endl;
+    return ok ? 0 : 1;
+}